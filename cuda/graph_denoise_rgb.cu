@@ -1,5 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <png.h>
+#include <string.h>
+#include <math.h>
 #include <cuda_runtime.h>
 
 
@@ -57,6 +61,69 @@ void write_ppm(const char *filename, PPMImage *img) {
     fclose(fp);
 }
 
+// Read an 8-bit RGB image from a PNG file with the libpng simplified API; grey, palette,
+// 16-bit and alpha images are converted (alpha is composited onto black)
+PPMImage *read_png(const char *filename) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename)) {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        return NULL;
+    }
+    image.format = PNG_FORMAT_RGB;
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    img->width = image.width;
+    img->height = image.height;
+    img->data = (unsigned char *)calloc(PNG_IMAGE_SIZE(image), 1);
+    if (!png_image_finish_read(&image, NULL, img->data, 0, NULL)) {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        png_image_free(&image);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+// Write an 8-bit RGB PNG; returns 0 on success
+int write_png(const char *filename, PPMImage *img) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = img->width;
+    image.height = img->height;
+    image.format = PNG_FORMAT_RGB;
+    if (!png_image_write_to_file(&image, filename, 0, img->data, 0, NULL)) {
+        fprintf(stderr, "Error writing PNG %s: %s\n", filename, image.message);
+        return -1;
+    }
+    return 0;
+}
+
+// Files ending in ".png" (any case) are PNG, everything else PPM
+int is_png_file(const char *filename) {
+    size_t length = strlen(filename);
+    if (length < 4)
+        return 0;
+    const char *ext = filename + length - 4;
+    return ext[0] == '.' && tolower((unsigned char)ext[1]) == 'p' && tolower((unsigned char)ext[2]) == 'n' &&
+           tolower((unsigned char)ext[3]) == 'g';
+}
+
+PPMImage *read_image(const char *filename) {
+    return is_png_file(filename) ? read_png(filename) : read_ppm(filename);
+}
+
+// Returns 0 on success
+int write_image(const char *filename, PPMImage *img) {
+    if (is_png_file(filename))
+        return write_png(filename, img);
+    write_ppm(filename, img);
+    return 0;
+}
+
 __global__ void graph_diffusion_kernel(unsigned char *input, unsigned char *output, int width, int height, float alpha, float sigma, float threshold) {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
@@ -90,14 +157,103 @@ __global__ void graph_diffusion_kernel(unsigned char *input, unsigned char *outp
     }
 }
 
+// Fixed-point variant of the graph kernel. Weights are Q15 integers from a table indexed by
+// the absolute difference, alpha is Q8, and the weighted average, threshold test and update
+// are done in integer arithmetic with flooring divides. Results do not depend on FMA
+// contraction or the expf implementation, so every backend produces the same bits.
+#define FIXED_WEIGHT_BITS 15
+#define FIXED_ALPHA_BITS 8
+
+__constant__ int d_weight_table[256];
+
+// Q15 Gaussian weight for every absolute difference 0..255. Computed in double on the host and
+// rounded, so all backends get the same integers.
+void graph_fixed_weight_table(int table[256], float sigma) {
+    for (int d = 0; d < 256; d++)
+        table[d] = (int)floor(exp(-(double)(d * d) / (2.0 * sigma * sigma)) * (1 << FIXED_WEIGHT_BITS) + 0.5);
+}
+
+int graph_fixed_alpha(float alpha) {
+    return (int)floor((double)alpha * (1 << FIXED_ALPHA_BITS) + 0.5);
+}
+
+// num / den rounded down, like the float kernels' conversion to unsigned char (den > 0)
+__device__ long long fixed_div_floor(long long num, long long den) {
+    return (num >= 0) ? num / den : -((-num + den - 1) / den);
+}
+
+// Integer counterpart of graph_diffusion_kernel
+__global__ void graph_diffusion_fixed_kernel(unsigned char *input, unsigned char *output, int width, int height, int alpha_q, int threshold) {
+    int x = blockIdx.x * blockDim.x + threadIdx.x;
+    int y = blockIdx.y * blockDim.y + threadIdx.y;
+
+    if (x > 0 && x < width - 1 && y > 0 && y < height - 1) {
+        for (int c = 0; c < 3; c++) {
+            int idx = (y * width + x) * 3 + c;
+            int center = input[idx];
+
+            int neighbors[4] = {
+                input[((y - 1) * width + x) * 3 + c],
+                input[((y + 1) * width + x) * 3 + c],
+                input[(y * width + (x - 1)) * 3 + c],
+                input[(y * width + (x + 1)) * 3 + c]
+            };
+
+            int weight_sum = 0, weighted_value = 0;
+            for (int i = 0; i < 4; i++) {
+                int weight = d_weight_table[abs(neighbors[i] - center)];
+                weight_sum += weight;
+                weighted_value += weight * neighbors[i];
+            }
+            if (weight_sum == 0) {
+                // Every neighbour is more than ~94 levels away. The float weights are then dominated by the
+                // closest neighbours, so take their mean (always above the threshold).
+                int closest = 256;
+                for (int i = 0; i < 4; i++) {
+                    int diff = abs(neighbors[i] - center);
+                    if (diff < closest) {
+                        closest = diff;
+                        weight_sum = 0;
+                        weighted_value = 0;
+                    }
+                    if (diff == closest) {
+                        weight_sum++;
+                        weighted_value += neighbors[i];
+                    }
+                }
+            }
+
+            // (smooth_value - center) scaled by weight_sum
+            long long deviation = weighted_value - (long long)center * weight_sum;
+            long long result;
+            if (llabs(deviation) > (long long)threshold * weight_sum)
+                result = fixed_div_floor(weighted_value, weight_sum);
+            else
+                result = fixed_div_floor(((long long)center * weight_sum << FIXED_ALPHA_BITS) + alpha_q * deviation,
+                                         (long long)weight_sum << FIXED_ALPHA_BITS);
+            output[idx] = (unsigned char)(result < 0 ? 0 : (result > 255 ? 255 : result));
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations>\n", argv[0]);
+    if (argc < 5) {
+        printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations> [--fixed-point]\n", argv[0]);
         return 1;
     }
 
     float alpha = atof(argv[3]);
     int iterations = atoi(argv[4]);
+
+    int fixed_point = 0;
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "--fixed-point") == 0) {
+            fixed_point = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
     if (iterations <= 0) {
         fprintf(stderr, "Iterations must be a positive integer.\n");
         return 1;
@@ -105,7 +261,7 @@ int main(int argc, char *argv[]) {
 
     clock_t total_start_time = clock();
 
-    PPMImage *input = read_ppm(argv[1]);
+    PPMImage *input = read_image(argv[1]);
     if (!input) return 1;
     
     PPMImage *output = (PPMImage*)malloc(sizeof(PPMImage));
@@ -117,6 +273,15 @@ int main(int argc, char *argv[]) {
     cudaMalloc(&d_input, input->width * input->height * 3);
     cudaMalloc(&d_output, input->width * input->height * 3);
     cudaMemcpy(d_input, input->data, input->width * input->height * 3, cudaMemcpyHostToDevice);
+    // The border is never written by the kernels, so it has to come from the input as well
+    cudaMemcpy(d_output, input->data, input->width * input->height * 3, cudaMemcpyHostToDevice);
+
+    if (fixed_point) {
+        int weight_table[256];
+        graph_fixed_weight_table(weight_table, 20.0f);
+        cudaMemcpyToSymbol(d_weight_table, weight_table, sizeof(weight_table));
+    }
+    int alpha_q = graph_fixed_alpha(alpha);
 
     dim3 threads_per_block(16, 16);
     dim3 blocks_per_grid((input->width + 15) / 16, (input->height + 15) / 16);
@@ -128,7 +293,10 @@ int main(int argc, char *argv[]) {
     // Start timing
     cudaEventRecord(start);
     for (int i = 0; i < iterations; i++) {
-        graph_diffusion_kernel<<<blocks_per_grid, threads_per_block>>>(d_input, d_output, input->width, input->height, alpha, 20.0f, 20.0f);
+        if (fixed_point)
+            graph_diffusion_fixed_kernel<<<blocks_per_grid, threads_per_block>>>(d_input, d_output, input->width, input->height, alpha_q, 20);
+        else
+            graph_diffusion_kernel<<<blocks_per_grid, threads_per_block>>>(d_input, d_output, input->width, input->height, alpha, 20.0f, 20.0f);
         cudaMemcpy(d_input, d_output, input->width * input->height * 3, cudaMemcpyDeviceToDevice);
     }
 
@@ -147,7 +315,7 @@ int main(int argc, char *argv[]) {
 
     cudaMemcpy(output->data, d_output, input->width * input->height * 3, cudaMemcpyDeviceToHost);
 
-    write_ppm(argv[2], output);
+    write_image(argv[2], output);
 
     printf("Total (Graph) process completed in %.4f seconds.\n", 
            (double)(clock() - total_start_time) / CLOCKS_PER_SEC);
@@ -8,31 +8,37 @@ noising_rate=$2  # Accept noising rate as an argument
 alpha=$3  # Accept alpha as an argument
 iterations=$4  # Accept number of iterations as an argument
 resize=$5            # Resize option: "yes" or "no"
+shift 5
+[[ $# -gt 0 && $1 != --* ]] && shift # an <np> argument is accepted but ignored
+graph_options=("$@") # Extra options forwarded to graph_denoise_rgb
 
 output_prefix=${input_image%.*}  # Base name without extension
 
-# Conditional resize
+# The programs read and write PNG and PPM directly; ImageMagick is only needed to resize
+# the input or to convert other formats
+converted_input=""
 if [ "$resize" == "yes" ]; then
-    convert "$input_image" -resize 4096x4096 "${output_prefix}.ppm"
-else
-    convert "$input_image" "${output_prefix}.ppm"
+    converted_input="${output_prefix}_4096.png"
+    convert "$input_image" -resize 4096x4096 "$converted_input"
+elif [[ $input_image != *.png && $input_image != *.ppm ]]; then
+    converted_input="${output_prefix}_input.png"
+    convert "$input_image" "$converted_input"
 fi
+input_image=${converted_input:-$input_image}
 
 # Compile CPU-based noise addition
-gcc -O3 -std=c99 -o add_noise add_noise.c -lm
+gcc -O3 -std=c99 -o add_noise add_noise.c -lpng -lm
 
-./add_noise "${output_prefix}.ppm" noisy_output.ppm "$noising_rate"
-
-convert noisy_output.ppm noisy_output.png
+./add_noise "$input_image" noisy_output.png "$noising_rate"
 
 # Run CUDA-based graph-based denoising
-nvcc -O3 -Wno-deprecated-gpu-targets -o graph_denoise_rgb graph_denoise_rgb.cu -lm
+nvcc -O3 -Wno-deprecated-gpu-targets -o graph_denoise_rgb graph_denoise_rgb.cu -lpng -lm
 
 runs=10  # Number of runs for averaging
 total_sum=0
 
 for i in $(seq 1 $runs); do
-    output=$(./graph_denoise_rgb noisy_output.ppm graph_denoised_output.ppm "$alpha" "$iterations")
+    output=$(./graph_denoise_rgb noisy_output.png graph_denoised_output.png "$alpha" "$iterations" "${graph_options[@]}")
     # Extract the total value
     total_value=$(echo "$output" | grep -oP 'Total.*?in\s+\K[0-9.]+')
     # Add to the sum
@@ -43,15 +49,13 @@ done
 average=$(echo "scale=4; $total_sum / $runs" | bc)
 echo "Graph average over $runs runs: $average"
 
-convert graph_denoised_output.ppm graph_denoised_output.png
-
 # Run CUDA-based median-based denoising
-nvcc -O3 -Wno-deprecated-gpu-targets -o median_denoise_rgb median_denoise_rgb.cu -lm
+nvcc -O3 -Wno-deprecated-gpu-targets -o median_denoise_rgb median_denoise_rgb.cu -lpng -lm
 
 total_sum=0
 
 for i in $(seq 1 $runs); do
-    output=$(./median_denoise_rgb noisy_output.ppm median_denoised_output.ppm)
+    output=$(./median_denoise_rgb noisy_output.png median_denoised_output.png)
     # Extract the total value
     total_value=$(echo "$output" | grep -oP 'Total.*?in\s+\K[0-9.]+')
     # Add to the sum
@@ -62,8 +66,6 @@ done
 average=$(echo "scale=4; $total_sum / $runs" | bc)
 echo "Median average over $runs runs: $average"
 
-convert median_denoised_output.ppm median_denoised_output.png
-
 # Clean up intermediate files
 rm -f graph_denoise_rgb median_denoise_rgb add_noise
-rm -f "${output_prefix}.ppm" noisy_output.ppm graph_denoised_output.ppm median_denoised_output.ppm
\ No newline at end of file
+[ -n "$converted_input" ] && rm -f "$converted_input"
\ No newline at end of file
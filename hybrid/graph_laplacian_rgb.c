@@ -0,0 +1,1359 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <omp.h> // Include OpenMP header
+
+typedef struct
+{
+    int width;
+    int height;
+    unsigned char *data; // RGB data stored as [R, G, B, R, G, B, ...]
+} PPMImage;
+
+// Read PPM (P6 format)
+PPMImage *read_ppm(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        perror("Error opening file");
+        return NULL;
+    }
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    char version[3];
+    if (fscanf(fp, "%2s", version) != 1)
+    {
+        fprintf(stderr, "Error reading PPM version\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    if (version[1] != '6')
+    {
+        fprintf(stderr, "Only P6 supported\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+
+    if (fscanf(fp, "%d %d %*d", &img->width, &img->height) != 2)
+    {
+        fprintf(stderr, "Error reading image dimensions\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    fgetc(fp); // Skip newline
+
+    img->data = (unsigned char *)malloc(img->width * img->height * 3);
+    if (fread(img->data, 1, img->width * img->height * 3, fp) != img->width * img->height * 3)
+    {
+        fprintf(stderr, "Error reading image data\n");
+        fclose(fp);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    fclose(fp);
+    return img;
+}
+
+// Write PPM (P6 format)
+void write_ppm(const char *filename, PPMImage *img)
+{
+    FILE *fp = fopen(filename, "wb");
+    fprintf(fp, "P6\n%d %d\n255\n", img->width, img->height);
+    fwrite(img->data, 1, img->width * img->height * 3, fp);
+    fclose(fp);
+}
+
+// Row block [row_start, row_end) of the image owned by rank. Rows are handed out in units of
+// align rows (the last unit may be shorter); align = 1 gives the split of graph_denoise_rgb.
+void block_rows(int height, int rank, int size, int align, int *row_start, int *row_end)
+{
+    int units = (height + align - 1) / align;
+    int units_per_proc = units / size;
+    int extra = units % size;
+    int unit_start = (rank < extra) ? rank * (units_per_proc + 1) : rank * units_per_proc + extra;
+    int unit_end = unit_start + ((rank < extra) ? units_per_proc + 1 : units_per_proc);
+    *row_start = unit_start * align;
+    *row_end = (unit_end * align < height) ? unit_end * align : height;
+}
+
+// Rows of the system matrix A = I + t L for the pixels owned by one rank, in CSR form.
+// L = D - W is the weighted Laplacian of the 4-connected pixel graph with the Gaussian edge
+// weights of graph_denoise_rgb. The sparsity pattern is shared by the three channels; values
+// are interleaved, values[k * 3 + c]. Column indices refer to the halo-extended local vector:
+// [0, halo) is the image row above the block, [halo, halo + rows) the owned pixels and
+// [halo + rows, 2 * halo + rows) the row below.
+typedef struct
+{
+    int rows;
+    int halo;
+    int *row_ptr;
+    int *col_idx;
+    float *values;
+} CSRMatrix;
+
+CSRMatrix build_laplacian_system(const unsigned char *image, int width, int height, int row_start, int row_end,
+                                 float t, float sigma)
+{
+    CSRMatrix A;
+    A.rows = (row_end - row_start) * width;
+    A.halo = width;
+    A.row_ptr = (int *)malloc((A.rows + 1) * sizeof(int));
+    A.col_idx = (int *)malloc(A.rows * 5 * sizeof(int));
+    A.values = (float *)malloc(A.rows * 5 * 3 * sizeof(float));
+
+    // Row i has the diagonal plus one entry per neighbour inside the image
+    A.row_ptr[0] = 0;
+    for (int i = 0; i < A.rows; i++)
+    {
+        int y = row_start + i / width, x = i % width;
+        int degree = (y > 0) + (y < height - 1) + (x > 0) + (x < width - 1);
+        A.row_ptr[i + 1] = A.row_ptr[i] + 1 + degree;
+    }
+
+    #pragma omp parallel for
+    for (int i = 0; i < A.rows; i++)
+    {
+        int y = row_start + i / width, x = i % width;
+        int p = y * width + x;
+        int k = A.row_ptr[i];
+
+        int neighbor_pixel[4] = {p - width, p + width, p - 1, p + 1};
+        int neighbor_local[4] = {i - width, i + width, i - 1, i + 1};
+        int present[4] = {y > 0, y < height - 1, x > 0, x < width - 1};
+
+        int diag = k++;
+        A.col_idx[diag] = A.halo + i;
+        float degree[3] = {0.0f, 0.0f, 0.0f};
+        for (int n = 0; n < 4; n++)
+        {
+            if (!present[n])
+                continue;
+            A.col_idx[k] = A.halo + neighbor_local[n];
+            for (int c = 0; c < 3; c++)
+            {
+                float diff = image[neighbor_pixel[n] * 3 + c] - image[p * 3 + c];
+                float weight = expf(-(diff * diff) / (2 * sigma * sigma));
+                A.values[k * 3 + c] = -t * weight;
+                degree[c] += weight;
+            }
+            k++;
+        }
+        for (int c = 0; c < 3; c++)
+            A.values[diag * 3 + c] = 1.0f + t * degree[c];
+    }
+    return A;
+}
+
+void free_csr(CSRMatrix *A)
+{
+    free(A->row_ptr);
+    free(A->col_idx);
+    free(A->values);
+}
+
+// Fill the halo rows of a halo-extended, channel-interleaved vector holding rows owned pixels
+// from the neighbouring ranks up and down (MPI_PROC_NULL at the ends of the image)
+void exchange_halos(float *x, int rows, int halo, int up, int down)
+{
+    int count = halo * 3;
+
+    // First owned row goes up, row below arrives from down; then the reverse
+    MPI_Sendrecv(x + halo * 3, count, MPI_FLOAT, up, 0,
+                 x + (halo + rows) * 3, count, MPI_FLOAT, down, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(x + rows * 3, count, MPI_FLOAT, down, 1,
+                 x, count, MPI_FLOAT, up, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+// y = A x for all three channels; x is halo-extended and its halos must be current
+void csr_spmv(const CSRMatrix *A, const float *x, float *y)
+{
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < A->rows; i++)
+    {
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        for (int k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++)
+        {
+            const float *xj = x + A->col_idx[k] * 3;
+            const float *a = A->values + k * 3;
+            sum[0] += a[0] * xj[0];
+            sum[1] += a[1] * xj[1];
+            sum[2] += a[2] * xj[2];
+        }
+        y[i * 3 + 0] = sum[0];
+        y[i * 3 + 1] = sum[1];
+        y[i * 3 + 2] = sum[2];
+    }
+}
+
+// Per-channel dot products of two local vectors of n pixels, summed over all ranks
+void dot3(const float *a, const float *b, int n, double result[3])
+{
+    double d0 = 0.0, d1 = 0.0, d2 = 0.0;
+    #pragma omp parallel for reduction(+ : d0, d1, d2)
+    for (int i = 0; i < n; i++)
+    {
+        d0 += (double)a[i * 3 + 0] * b[i * 3 + 0];
+        d1 += (double)a[i * 3 + 1] * b[i * 3 + 1];
+        d2 += (double)a[i * 3 + 2] * b[i * 3 + 2];
+    }
+    double local[3] = {d0, d1, d2};
+    MPI_Allreduce(local, result, 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+}
+
+// z = M^-1 r for a symmetric positive definite preconditioner M; r and z hold n pixels
+typedef void (*Preconditioner)(void *context, const float *r, float *z, int n);
+
+// Jacobi preconditioner; context is the inverted diagonal of A
+void jacobi_precondition(void *context, const float *r, float *z, int n)
+{
+    const float *inv_diag = (const float *)context;
+    #pragma omp parallel for
+    for (int i = 0; i < n * 3; i++)
+        z[i] = inv_diag[i] * r[i];
+}
+
+// Preconditioned conjugate gradient on A u = b, run for the three channels at once (three
+// independent recurrences sharing every SpMV pass). u holds the initial guess on entry.
+// A channel stops updating once ||r|| <= tolerance * ||b||. Returns the iterations performed.
+int pcg_solve(const CSRMatrix *A, const float *b, float *u, float tolerance, int max_iterations,
+              Preconditioner precondition, void *context, int rank, int size)
+{
+    int n = A->rows, halo = A->halo;
+    int up = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+    float *r = (float *)malloc(n * 3 * sizeof(float));
+    float *z = (float *)malloc(n * 3 * sizeof(float));
+    float *q = (float *)malloc(n * 3 * sizeof(float));
+    float *p = (float *)calloc((n + 2 * halo) * 3, sizeof(float)); // halo-extended
+    float *p_own = p + halo * 3;
+
+    // r = b - A u, using p as the halo-extended copy of u
+    memcpy(p_own, u, n * 3 * sizeof(float));
+    exchange_halos(p, n, halo, up, down);
+    csr_spmv(A, p, q);
+    #pragma omp parallel for
+    for (int i = 0; i < n * 3; i++)
+        r[i] = b[i] - q[i];
+    precondition(context, r, z, n);
+    memcpy(p_own, z, n * 3 * sizeof(float));
+
+    double bb[3], rz[3], rr[3];
+    dot3(b, b, n, bb);
+    dot3(r, z, n, rz);
+    dot3(r, r, n, rr);
+
+    int active[3], iter = 0;
+    for (int c = 0; c < 3; c++)
+        active[c] = rr[c] > (double)tolerance * tolerance * bb[c];
+
+    while (iter < max_iterations && (active[0] || active[1] || active[2]))
+    {
+        exchange_halos(p, n, halo, up, down);
+        csr_spmv(A, p, q);
+
+        double pq[3];
+        dot3(p_own, q, n, pq);
+        float step[3];
+        for (int c = 0; c < 3; c++)
+            step[c] = (active[c] && pq[c] > 0.0) ? (float)(rz[c] / pq[c]) : 0.0f;
+
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                int k = i * 3 + c;
+                u[k] += step[c] * p_own[k];
+                r[k] -= step[c] * q[k];
+            }
+        }
+        precondition(context, r, z, n);
+
+        double rz_new[3];
+        dot3(r, z, n, rz_new);
+        dot3(r, r, n, rr);
+        float beta[3];
+        for (int c = 0; c < 3; c++)
+        {
+            beta[c] = (active[c] && rz[c] > 0.0) ? (float)(rz_new[c] / rz[c]) : 0.0f;
+            rz[c] = rz_new[c];
+        }
+
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < 3; c++)
+                p_own[i * 3 + c] = z[i * 3 + c] + beta[c] * p_own[i * 3 + c];
+        }
+
+        iter++;
+        for (int c = 0; c < 3; c++)
+            active[c] = active[c] && rr[c] > (double)tolerance * tolerance * bb[c];
+    }
+
+    if (rank == 0)
+    {
+        printf("PCG finished after %d iterations, relative residual %.2e %.2e %.2e.\n", iter,
+               sqrt(rr[0] / (bb[0] > 0 ? bb[0] : 1)), sqrt(rr[1] / (bb[1] > 0 ? bb[1] : 1)),
+               sqrt(rr[2] / (bb[2] > 0 ? bb[2] : 1)));
+    }
+
+    free(r);
+    free(z);
+    free(q);
+    free(p);
+    return iter;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Geometric multigrid for A = M + t L on the pixel grid.
+// Level k is the image coarsened 2x2 k times. Coarse operators are the Galerkin products
+// P^T A P for piecewise-constant prolongation P: the mass of an aggregate is the number of
+// fine pixels in it and a coarse edge weight is the sum of the fine edge weights crossing
+// between the two aggregates, so strong edges stay strong on every level. Row blocks are
+// aligned to 2^(levels - 1) image rows, so restriction and prolongation never cross ranks.
+// The coarsest level is gathered on rank 0 and solved there.
+
+#define MG_MAX_LEVELS 16
+
+typedef struct
+{
+    int width, height;      // global size of the level
+    int row_start, row_end; // owned rows
+    int up, down;           // neighbouring ranks, MPI_PROC_NULL at the image ends
+    float *mass;            // identity part of A: fine pixels per node
+    float *east;            // t * weight of edge (x, y)-(x + 1, y); 0 in the last column
+    float *south;           // t * weight of edge (x, y)-(x, y + 1); 0 in the last row
+    float *south_above;     // south weights of the row above row_start (one row)
+    float *diag;            // mass + incident weights
+    float *u;               // halo-extended solution
+    float *b, *r;
+} GridLevel;
+
+typedef struct
+{
+    int count;                       // distributed levels
+    int smooth_steps;                // red-black sweeps before and after the coarse correction
+    GridLevel levels[MG_MAX_LEVELS];
+    GridLevel coarse;                // whole coarsest level, on rank 0 only
+    int *coarse_counts, *coarse_displs;
+    int rank;
+} Multigrid;
+
+// Number of levels for an image split over size ranks: coarsen while every rank still owns at
+// least one aligned unit of rows and the coarsest grid is above 32x32 pixels
+int mg_level_count(int width, int height, int size)
+{
+    int levels = 1;
+    while (levels < MG_MAX_LEVELS)
+    {
+        int w = (width + (1 << (levels - 1)) - 1) >> (levels - 1);
+        int h = (height + (1 << (levels - 1)) - 1) >> (levels - 1);
+        if (w * h <= 32 * 32 || height / (1 << levels) < size)
+            break;
+        levels++;
+    }
+    return levels;
+}
+
+void grid_alloc(GridLevel *L, int width, int height, int row_start, int row_end, int up, int down)
+{
+    int n = (row_end - row_start) * width;
+    L->width = width;
+    L->height = height;
+    L->row_start = row_start;
+    L->row_end = row_end;
+    L->up = up;
+    L->down = down;
+    L->mass = (float *)calloc(n * 3, sizeof(float));
+    L->east = (float *)calloc(n * 3, sizeof(float));
+    L->south = (float *)calloc(n * 3, sizeof(float));
+    L->south_above = (float *)calloc(width * 3, sizeof(float));
+    L->diag = (float *)calloc(n * 3, sizeof(float));
+    L->u = (float *)calloc((n + 2 * width) * 3, sizeof(float)); // halos stay 0 at the image ends
+    L->b = (float *)calloc(n * 3, sizeof(float));
+    L->r = (float *)calloc(n * 3, sizeof(float));
+}
+
+void grid_free(GridLevel *L)
+{
+    free(L->mass);
+    free(L->east);
+    free(L->south);
+    free(L->south_above);
+    free(L->diag);
+    free(L->u);
+    free(L->b);
+    free(L->r);
+}
+
+void grid_update_diag(GridLevel *L)
+{
+    int width = L->width, rows = L->row_end - L->row_start;
+    #pragma omp parallel for
+    for (int i = 0; i < rows * width; i++)
+    {
+        int x = i % width;
+        for (int c = 0; c < 3; c++)
+        {
+            int k = i * 3 + c;
+            float north = (i >= width) ? L->south[k - width * 3] : L->south_above[x * 3 + c];
+            float west = (x > 0) ? L->east[k - 3] : 0.0f;
+            L->diag[k] = L->mass[k] + L->east[k] + west + L->south[k] + north;
+        }
+    }
+}
+
+// Finest level: A = I + t L with the Gaussian weights of the input image
+void grid_build_fine(GridLevel *L, const unsigned char *image, float t, float sigma)
+{
+    int width = L->width, height = L->height;
+    #pragma omp parallel for
+    for (int y = L->row_start - 1; y < L->row_end; y++)
+    {
+        if (y < 0)
+            continue;
+        for (int x = 0; x < width; x++)
+        {
+            int p = y * width + x;
+            for (int c = 0; c < 3; c++)
+            {
+                int k = ((y - L->row_start) * width + x) * 3 + c;
+                float south = 0.0f;
+                if (y < height - 1)
+                {
+                    float diff = image[(p + width) * 3 + c] - image[p * 3 + c];
+                    south = t * expf(-(diff * diff) / (2 * sigma * sigma));
+                }
+                if (y < L->row_start)
+                {
+                    L->south_above[x * 3 + c] = south;
+                    continue;
+                }
+                L->south[k] = south;
+                L->mass[k] = 1.0f;
+                if (x < width - 1)
+                {
+                    float diff = image[(p + 1) * 3 + c] - image[p * 3 + c];
+                    L->east[k] = t * expf(-(diff * diff) / (2 * sigma * sigma));
+                }
+            }
+        }
+    }
+    grid_update_diag(L);
+}
+
+// Galerkin coarsening of fine into coarse (already allocated with the halved row block)
+void grid_build_coarse(const GridLevel *F, GridLevel *C)
+{
+    int fw = F->width, fh = F->height, cw = C->width;
+    int crows = C->row_end - C->row_start;
+    #pragma omp parallel for
+    for (int Y = 0; Y < crows; Y++)
+    {
+        int fy0 = 2 * (C->row_start + Y), fy1 = fy0 + 1;
+        int has_y1 = fy1 < fh && fy1 < F->row_end;
+        for (int X = 0; X < cw; X++)
+        {
+            int fx0 = 2 * X, fx1 = fx0 + 1;
+            int has_x1 = fx1 < fw;
+            int i00 = (fy0 - F->row_start) * fw + fx0;
+            for (int c = 0; c < 3; c++)
+            {
+                int k = (Y * cw + X) * 3 + c;
+                float mass = F->mass[i00 * 3 + c];
+                float east = 0.0f, south = 0.0f;
+                // Edges leaving the aggregate to the east start in column fx1, edges to the south
+                // in row fy1; without such a column/row the aggregate is on the image border
+                if (has_x1)
+                {
+                    mass += F->mass[(i00 + 1) * 3 + c];
+                    east += F->east[(i00 + 1) * 3 + c];
+                }
+                if (has_y1)
+                {
+                    int i10 = i00 + fw;
+                    mass += F->mass[i10 * 3 + c];
+                    south += F->south[i10 * 3 + c];
+                    if (has_x1)
+                    {
+                        mass += F->mass[(i10 + 1) * 3 + c];
+                        south += F->south[(i10 + 1) * 3 + c];
+                        east += F->east[(i10 + 1) * 3 + c];
+                    }
+                }
+                C->mass[k] = mass;
+                C->east[k] = east;
+                C->south[k] = south;
+                if (Y == 0)
+                {
+                    C->south_above[X * 3 + c] = F->south_above[fx0 * 3 + c] +
+                                                (has_x1 ? F->south_above[fx1 * 3 + c] : 0.0f);
+                }
+            }
+        }
+    }
+    grid_update_diag(C);
+}
+
+// Sum over the neighbours q of pixel i (local index, column x) of w_pq * u_q for channel c.
+// u points at the first owned pixel of a halo-extended vector.
+static inline float grid_neighbor_sum(const GridLevel *L, const float *u, int i, int x, int c)
+{
+    int width = L->width, k = i * 3 + c;
+    float north = (i >= width) ? L->south[k - width * 3] : L->south_above[x * 3 + c];
+    float sum = north * u[k - width * 3] + L->south[k] * u[k + width * 3];
+    if (x > 0)
+        sum += L->east[k - 3] * u[k - 3];
+    if (x < width - 1)
+        sum += L->east[k] * u[k + 3];
+    return sum;
+}
+
+// One red-black Gauss-Seidel half sweep over the pixels with (x + y) % 2 == color
+void grid_smooth_color(GridLevel *L, int color)
+{
+    int width = L->width, rows = L->row_end - L->row_start;
+    float *u = L->u + width * 3;
+    exchange_halos(L->u, rows * width, width, L->up, L->down);
+    #pragma omp parallel for
+    for (int ly = 0; ly < rows; ly++)
+    {
+        int y = L->row_start + ly;
+        for (int x = (y + color) & 1; x < width; x += 2)
+        {
+            int i = ly * width + x;
+            for (int c = 0; c < 3; c++)
+                u[i * 3 + c] = (L->b[i * 3 + c] + grid_neighbor_sum(L, u, i, x, c)) / L->diag[i * 3 + c];
+        }
+    }
+}
+
+// r = b - A u
+void grid_residual(GridLevel *L)
+{
+    int width = L->width, rows = L->row_end - L->row_start;
+    float *u = L->u + width * 3;
+    exchange_halos(L->u, rows * width, width, L->up, L->down);
+    #pragma omp parallel for
+    for (int i = 0; i < rows * width; i++)
+    {
+        int x = i % width;
+        for (int c = 0; c < 3; c++)
+        {
+            int k = i * 3 + c;
+            L->r[k] = L->b[k] - (L->diag[k] * u[k] - grid_neighbor_sum(L, u, i, x, c));
+        }
+    }
+}
+
+// Solve the whole coarsest level on this rank with Jacobi-preconditioned CG
+void grid_solve_local(GridLevel *L, int max_iterations, double tolerance)
+{
+    int n = L->width * L->height;
+    float *u = L->u + L->width * 3;
+    float *p = (float *)calloc((n + 2 * L->width) * 3, sizeof(float));
+    float *p_own = p + L->width * 3;
+    float *q = (float *)malloc(n * 3 * sizeof(float));
+    float *z = (float *)malloc(n * 3 * sizeof(float));
+    double rz[3] = {0, 0, 0}, bb[3] = {0, 0, 0};
+
+    memset(u, 0, n * 3 * sizeof(float));
+    for (int k = 0; k < n * 3; k++)
+    {
+        L->r[k] = L->b[k];
+        z[k] = L->r[k] / L->diag[k];
+        p_own[k] = z[k];
+        rz[k % 3] += (double)L->r[k] * z[k];
+        bb[k % 3] += (double)L->b[k] * L->b[k];
+    }
+
+    for (int iter = 0; iter < max_iterations; iter++)
+    {
+        double pq[3] = {0, 0, 0}, rr[3] = {0, 0, 0}, rz_new[3] = {0, 0, 0};
+        for (int i = 0; i < n; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                int k = i * 3 + c;
+                q[k] = L->diag[k] * p_own[k] - grid_neighbor_sum(L, p_own, i, i % L->width, c);
+                pq[c] += (double)p_own[k] * q[k];
+            }
+        }
+        for (int k = 0; k < n * 3; k++)
+        {
+            int c = k % 3;
+            float step = (pq[c] > 0.0) ? (float)(rz[c] / pq[c]) : 0.0f;
+            u[k] += step * p_own[k];
+            L->r[k] -= step * q[k];
+            z[k] = L->r[k] / L->diag[k];
+            rr[c] += (double)L->r[k] * L->r[k];
+            rz_new[c] += (double)L->r[k] * z[k];
+        }
+        if (rr[0] <= tolerance * tolerance * bb[0] && rr[1] <= tolerance * tolerance * bb[1] &&
+            rr[2] <= tolerance * tolerance * bb[2])
+            break;
+        for (int k = 0; k < n * 3; k++)
+        {
+            int c = k % 3;
+            float beta = (rz[c] > 0.0) ? (float)(rz_new[c] / rz[c]) : 0.0f;
+            p_own[k] = z[k] + beta * p_own[k];
+        }
+        for (int c = 0; c < 3; c++)
+            rz[c] = rz_new[c];
+    }
+
+    free(p);
+    free(q);
+    free(z);
+}
+
+Multigrid *mg_build(const unsigned char *image, int width, int height, int levels, float t, float sigma,
+                    int rank, int size)
+{
+    Multigrid *mg = (Multigrid *)calloc(1, sizeof(Multigrid));
+    mg->count = levels;
+    mg->smooth_steps = 2;
+    mg->rank = rank;
+
+    int up = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+    int down = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+    int row_start, row_end;
+    block_rows(height, rank, size, 1 << (levels - 1), &row_start, &row_end);
+
+    grid_alloc(&mg->levels[0], width, height, row_start, row_end, up, down);
+    grid_build_fine(&mg->levels[0], image, t, sigma);
+    for (int l = 1; l < levels; l++)
+    {
+        GridLevel *F = &mg->levels[l - 1];
+        grid_alloc(&mg->levels[l], (F->width + 1) / 2, (F->height + 1) / 2,
+                   F->row_start / 2, (F->row_end + 1) / 2, up, down);
+        grid_build_coarse(F, &mg->levels[l]);
+    }
+
+    // Gather the coarsest operator on rank 0
+    GridLevel *D = &mg->levels[levels - 1];
+    int local = (D->row_end - D->row_start) * D->width * 3;
+    if (rank == 0)
+    {
+        mg->coarse_counts = (int *)malloc(size * sizeof(int));
+        mg->coarse_displs = (int *)malloc(size * sizeof(int));
+        grid_alloc(&mg->coarse, D->width, D->height, 0, D->height, MPI_PROC_NULL, MPI_PROC_NULL);
+    }
+    MPI_Gather(&local, 1, MPI_INT, mg->coarse_counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+    {
+        mg->coarse_displs[0] = 0;
+        for (int i = 1; i < size; i++)
+            mg->coarse_displs[i] = mg->coarse_displs[i - 1] + mg->coarse_counts[i - 1];
+    }
+    MPI_Gatherv(D->mass, local, MPI_FLOAT, mg->coarse.mass, mg->coarse_counts, mg->coarse_displs, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(D->east, local, MPI_FLOAT, mg->coarse.east, mg->coarse_counts, mg->coarse_displs, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(D->south, local, MPI_FLOAT, mg->coarse.south, mg->coarse_counts, mg->coarse_displs, MPI_FLOAT, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+        grid_update_diag(&mg->coarse);
+
+    return mg;
+}
+
+void mg_free(Multigrid *mg)
+{
+    for (int l = 0; l < mg->count; l++)
+        grid_free(&mg->levels[l]);
+    if (mg->rank == 0)
+    {
+        grid_free(&mg->coarse);
+        free(mg->coarse_counts);
+        free(mg->coarse_displs);
+    }
+    free(mg);
+}
+
+// V-cycle for A_l u_l = b_l starting from u_l = 0
+void mg_vcycle(Multigrid *mg, int l)
+{
+    GridLevel *L = &mg->levels[l];
+    int width = L->width, rows = L->row_end - L->row_start;
+    float *u = L->u + width * 3;
+
+    if (l == mg->count - 1)
+    {
+        // Coarsest level: gather the right-hand side, solve on rank 0, scatter the solution
+        int local = rows * width * 3;
+        MPI_Gatherv(L->b, local, MPI_FLOAT, mg->coarse.b, mg->coarse_counts, mg->coarse_displs, MPI_FLOAT, 0, MPI_COMM_WORLD);
+        if (mg->rank == 0)
+            grid_solve_local(&mg->coarse, 1000, 1e-6);
+        MPI_Scatterv(mg->rank == 0 ? mg->coarse.u + mg->coarse.width * 3 : NULL, mg->coarse_counts, mg->coarse_displs,
+                     MPI_FLOAT, u, local, MPI_FLOAT, 0, MPI_COMM_WORLD);
+        return;
+    }
+
+    memset(u, 0, rows * width * 3 * sizeof(float));
+    for (int s = 0; s < mg->smooth_steps; s++)
+    {
+        grid_smooth_color(L, 0);
+        grid_smooth_color(L, 1);
+    }
+    grid_residual(L);
+
+    // Restriction: the coarse right-hand side is the residual summed over each 2x2 aggregate
+    GridLevel *C = &mg->levels[l + 1];
+    int crows = C->row_end - C->row_start;
+    #pragma omp parallel for
+    for (int Y = 0; Y < crows; Y++)
+    {
+        for (int X = 0; X < C->width; X++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                float sum = 0.0f;
+                for (int fy = 2 * (C->row_start + Y); fy < 2 * (C->row_start + Y) + 2 && fy < L->row_end; fy++)
+                    for (int fx = 2 * X; fx < 2 * X + 2 && fx < width; fx++)
+                        sum += L->r[((fy - L->row_start) * width + fx) * 3 + c];
+                C->b[(Y * C->width + X) * 3 + c] = sum;
+            }
+        }
+    }
+
+    mg_vcycle(mg, l + 1);
+
+    // Prolongation: add the coarse correction to every pixel of its aggregate
+    float *cu = C->u + C->width * 3;
+    #pragma omp parallel for
+    for (int ly = 0; ly < rows; ly++)
+    {
+        int Y = (L->row_start + ly) / 2 - C->row_start;
+        for (int x = 0; x < width; x++)
+            for (int c = 0; c < 3; c++)
+                u[(ly * width + x) * 3 + c] += cu[(Y * C->width + x / 2) * 3 + c];
+    }
+
+    // Post-smoothing in the reverse color order keeps the cycle symmetric for CG
+    for (int s = 0; s < mg->smooth_steps; s++)
+    {
+        grid_smooth_color(L, 1);
+        grid_smooth_color(L, 0);
+    }
+}
+
+// Multigrid preconditioner: one V-cycle; context is the Multigrid hierarchy
+void mg_precondition(void *context, const float *r, float *z, int n)
+{
+    Multigrid *mg = (Multigrid *)context;
+    GridLevel *L = &mg->levels[0];
+    memcpy(L->b, r, n * 3 * sizeof(float));
+    mg_vcycle(mg, 0);
+    memcpy(z, L->u + L->width * 3, n * 3 * sizeof(float));
+}
+
+// ---------------------------------------------------------------------------------------------
+// Chebyshev spectral filtering: u = h(L) f for a low-pass response h, approximated by a K-term
+// Chebyshev expansion on [0, lambda_max]. Every term costs one matrix-free Laplacian apply on
+// the 4-neighbour stencil (the GridLevel of the finest level with t = 1), threaded with OpenMP
+// and with one halo-row exchange between ranks.
+
+enum
+{
+    RESPONSE_HEAT,    // h(lambda) = exp(-t lambda), heat diffusion for time t
+    RESPONSE_TIKHONOV // h(lambda) = 1 / (1 + t lambda), same as the implicit step
+};
+
+double filter_response(int response, double t, double lambda)
+{
+    return (response == RESPONSE_HEAT) ? exp(-t * lambda) : 1.0 / (1.0 + t * lambda);
+}
+
+// y = L x per channel, where L = D - W is the weighted graph Laplacian of level G (built with
+// t = 1, so diag - mass is the degree). x is halo-extended, y holds only the owned pixels.
+void laplacian_apply(GridLevel *G, float *x, float *y)
+{
+    int width = G->width, rows = G->row_end - G->row_start;
+    const float *x_own = x + width * 3;
+    exchange_halos(x, rows * width, width, G->up, G->down);
+    #pragma omp parallel for
+    for (int i = 0; i < rows * width; i++)
+    {
+        int xcol = i % width;
+        for (int c = 0; c < 3; c++)
+        {
+            int k = i * 3 + c;
+            y[k] = (G->diag[k] - G->mass[k]) * x_own[k] - grid_neighbor_sum(G, x_own, i, xcol, c);
+        }
+    }
+}
+
+// Upper bound of the largest eigenvalue of L per channel. By Gershgorin every eigenvalue lies
+// within degree_i of degree_i for some pixel i, so lambda_max <= 2 * max degree (at most 8 for
+// these weights). A power-iteration estimate would fall below the true value, and the expansion
+// diverges on eigenvalues outside [0, lambda_max].
+void laplacian_lambda_bound(GridLevel *G, double lambda_max[3])
+{
+    int n = (G->row_end - G->row_start) * G->width;
+    double local[3];
+    for (int c = 0; c < 3; c++)
+    {
+        double max_degree = 0.0;
+        #pragma omp parallel for reduction(max : max_degree)
+        for (int i = 0; i < n; i++)
+        {
+            double degree = G->diag[i * 3 + c] - G->mass[i * 3 + c];
+            if (degree > max_degree)
+                max_degree = degree;
+        }
+        local[c] = 2.0 * max_degree;
+    }
+    MPI_Allreduce(local, lambda_max, 3, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    for (int c = 0; c < 3; c++)
+        if (lambda_max[c] <= 0.0)
+            lambda_max[c] = 1.0; // no edges: L = 0
+}
+
+// u = h(L) f with an order-term Chebyshev expansion; f and u hold the owned pixels
+void chebyshev_filter(GridLevel *G, const float *f, float *u, int response, float t, int order, int rank)
+{
+    int width = G->width, n = (G->row_end - G->row_start) * width;
+    double lambda_max[3];
+    laplacian_lambda_bound(G, lambda_max);
+
+    // Coefficients c_k of h on [0, lambda_max] from Chebyshev-Gauss quadrature
+    int nodes = 2 * order;
+    double pi = acos(-1.0);
+    float coeff[3][64];
+    for (int c = 0; c < 3; c++)
+    {
+        for (int k = 0; k < order; k++)
+        {
+            double sum = 0.0;
+            for (int j = 0; j < nodes; j++)
+            {
+                double theta = pi * (j + 0.5) / nodes;
+                double lambda = 0.5 * lambda_max[c] * (cos(theta) + 1.0);
+                sum += filter_response(response, t, lambda) * cos(k * theta);
+            }
+            coeff[c][k] = (float)(2.0 * sum / nodes);
+        }
+        coeff[c][0] *= 0.5f;
+    }
+    if (rank == 0)
+        printf("Chebyshev filter: %d terms, lambda_max %.3f %.3f %.3f.\n", order, lambda_max[0], lambda_max[1], lambda_max[2]);
+
+    // Three-term recurrence on the shifted operator S = (2 / lambda_max) L - I:
+    // T_0 = f, T_1 = S f, T_{k+1} = 2 S T_k - T_{k-1}
+    float *prev = (float *)calloc((n + 2 * width) * 3, sizeof(float));
+    float *curr = (float *)calloc((n + 2 * width) * 3, sizeof(float));
+    float *lf = (float *)malloc(n * 3 * sizeof(float));
+    float scale[3];
+    for (int c = 0; c < 3; c++)
+        scale[c] = (float)(2.0 / lambda_max[c]);
+
+    memcpy(prev + width * 3, f, n * 3 * sizeof(float));
+    laplacian_apply(G, prev, lf);
+    #pragma omp parallel for
+    for (int i = 0; i < n * 3; i++)
+    {
+        float t0 = prev[width * 3 + i];
+        float t1 = scale[i % 3] * lf[i] - t0;
+        curr[width * 3 + i] = t1;
+        u[i] = coeff[i % 3][0] * t0 + (order > 1 ? coeff[i % 3][1] * t1 : 0.0f);
+    }
+
+    for (int k = 2; k < order; k++)
+    {
+        laplacian_apply(G, curr, lf);
+        #pragma omp parallel for
+        for (int i = 0; i < n * 3; i++)
+        {
+            int c = i % 3;
+            float next = 2.0f * (scale[c] * lf[i] - curr[width * 3 + i]) - prev[width * 3 + i];
+            prev[width * 3 + i] = next; // becomes T_{k}, curr stays T_{k-1} until the swap
+            u[i] += coeff[c][k] * next;
+        }
+        float *swap = prev;
+        prev = curr;
+        curr = swap;
+    }
+
+    free(prev);
+    free(curr);
+    free(lf);
+}
+
+// Compare the Chebyshev tikhonov result u with the CG solve of the same (I + t L) u = f and
+// report the largest difference (in grey levels) over all ranks
+void chebyshev_check(const unsigned char *image, int width, int height, int row_start, int row_end, float t,
+                     float sigma, const float *f, const float *u, float tolerance, int max_iterations, int rank,
+                     int size)
+{
+    int n = (row_end - row_start) * width;
+    CSRMatrix A = build_laplacian_system(image, width, height, row_start, row_end, t, sigma);
+    float *inv_diag = (float *)malloc(n * 3 * sizeof(float));
+    float *exact = (float *)malloc(n * 3 * sizeof(float));
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++)
+        for (int c = 0; c < 3; c++)
+            inv_diag[i * 3 + c] = 1.0f / A.values[A.row_ptr[i] * 3 + c];
+    memcpy(exact, f, n * 3 * sizeof(float));
+    pcg_solve(&A, f, exact, tolerance, max_iterations, jacobi_precondition, inv_diag, rank, size);
+
+    double local_max = 0.0, local_sum = 0.0;
+    #pragma omp parallel for reduction(max : local_max) reduction(+ : local_sum)
+    for (int i = 0; i < n * 3; i++)
+    {
+        double diff = fabs((double)u[i] - exact[i]);
+        local_sum += diff;
+        if (diff > local_max)
+            local_max = diff;
+    }
+    double max_diff, sum_diff;
+    MPI_Reduce(&local_max, &max_diff, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&local_sum, &sum_diff, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0)
+        printf("Chebyshev vs CG: max difference %.3f, mean %.4f.\n", max_diff,
+               sum_diff / ((double)width * height * 3));
+
+    free(inv_diag);
+    free(exact);
+    free_csr(&A);
+}
+
+// Semi-implicit solve of one image line for AOS: (I + tau2 L) v = u for the three interleaved
+// channels of n pixels, where L is the Laplacian of the path graph along the line with the
+// Gaussian weights of the current values u (lagged diffusivity). The system is tridiagonal and
+// diagonally dominant, so the Thomas algorithm is stable for any tau2. cp and dp are scratch
+// arrays of n floats.
+void aos_line_solve(const float *u, float *v, int n, float tau2, float sigma, float *cp, float *dp)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        float w_prev = 0.0f;
+        for (int i = 0; i < n; i++)
+        {
+            float w = 0.0f;
+            if (i < n - 1)
+            {
+                float diff = u[(i + 1) * 3 + c] - u[i * 3 + c];
+                w = expf(-(diff * diff) / (2 * sigma * sigma));
+            }
+            float a = -tau2 * w_prev, b = 1.0f + tau2 * (w_prev + w);
+            float denom = (i > 0) ? b - a * cp[i - 1] : b;
+            cp[i] = -tau2 * w / denom;
+            dp[i] = (i > 0) ? (u[i * 3 + c] - a * dp[i - 1]) / denom : u[i * 3 + c] / denom;
+            w_prev = w;
+        }
+        v[(n - 1) * 3 + c] = dp[n - 1];
+        for (int i = n - 2; i >= 0; i--)
+            v[i * 3 + c] = dp[i] - cp[i] * v[(i + 1) * 3 + c];
+    }
+}
+
+// Redistribute a channel-interleaved image between row blocks (every rank holds rows
+// [row_start, row_end) row-major in rows) and column blocks (columns [col_start, col_end)
+// column-major in cols, i.e. cols[((x - col_start) * height + y) * 3 + c]) with one
+// MPI_Alltoallv. to_columns selects the direction.
+void aos_transpose(float *rows, float *cols, int width, int height, int to_columns, int rank, int size)
+{
+    int row_start, row_end, col_start, col_end;
+    block_rows(height, rank, size, 1, &row_start, &row_end);
+    block_rows(width, rank, size, 1, &col_start, &col_end);
+    int local_rows = row_end - row_start, local_cols = col_end - col_start;
+
+    int *counts_rows = malloc(size * sizeof(int)), *displs_rows = malloc(size * sizeof(int));
+    int *counts_cols = malloc(size * sizeof(int)), *displs_cols = malloc(size * sizeof(int));
+    int offset_rows = 0, offset_cols = 0;
+    for (int q = 0; q < size; q++)
+    {
+        int start, end;
+        // Row side: my rows x the columns of q; column side: the rows of q x my columns
+        block_rows(width, q, size, 1, &start, &end);
+        counts_rows[q] = local_rows * (end - start) * 3;
+        block_rows(height, q, size, 1, &start, &end);
+        counts_cols[q] = (end - start) * local_cols * 3;
+        displs_rows[q] = offset_rows;
+        displs_cols[q] = offset_cols;
+        offset_rows += counts_rows[q];
+        offset_cols += counts_cols[q];
+    }
+    float *packed_rows = (float *)malloc((offset_rows + 1) * sizeof(float));
+    float *packed_cols = (float *)malloc((offset_cols + 1) * sizeof(float));
+
+    if (to_columns)
+    {
+        #pragma omp parallel for
+        for (int q = 0; q < size; q++)
+        {
+            int start, end;
+            block_rows(width, q, size, 1, &start, &end);
+            float *out = packed_rows + displs_rows[q];
+            for (int y = 0; y < local_rows; y++)
+                for (int x = start; x < end; x++)
+                    for (int c = 0; c < 3; c++)
+                        *out++ = rows[(y * width + x) * 3 + c];
+        }
+        MPI_Alltoallv(packed_rows, counts_rows, displs_rows, MPI_FLOAT,
+                      packed_cols, counts_cols, displs_cols, MPI_FLOAT, MPI_COMM_WORLD);
+        #pragma omp parallel for
+        for (int q = 0; q < size; q++)
+        {
+            int start, end;
+            block_rows(height, q, size, 1, &start, &end);
+            const float *in = packed_cols + displs_cols[q];
+            for (int y = start; y < end; y++)
+                for (int x = 0; x < local_cols; x++)
+                    for (int c = 0; c < 3; c++)
+                        cols[(x * height + y) * 3 + c] = *in++;
+        }
+    }
+    else
+    {
+        #pragma omp parallel for
+        for (int q = 0; q < size; q++)
+        {
+            int start, end;
+            block_rows(height, q, size, 1, &start, &end);
+            float *out = packed_cols + displs_cols[q];
+            for (int y = start; y < end; y++)
+                for (int x = 0; x < local_cols; x++)
+                    for (int c = 0; c < 3; c++)
+                        *out++ = cols[(x * height + y) * 3 + c];
+        }
+        MPI_Alltoallv(packed_cols, counts_cols, displs_cols, MPI_FLOAT,
+                      packed_rows, counts_rows, displs_rows, MPI_FLOAT, MPI_COMM_WORLD);
+        #pragma omp parallel for
+        for (int q = 0; q < size; q++)
+        {
+            int start, end;
+            block_rows(width, q, size, 1, &start, &end);
+            const float *in = packed_rows + displs_rows[q];
+            for (int y = 0; y < local_rows; y++)
+                for (int x = start; x < end; x++)
+                    for (int c = 0; c < 3; c++)
+                        rows[(y * width + x) * 3 + c] = *in++;
+        }
+    }
+
+    free(counts_rows);
+    free(displs_rows);
+    free(counts_cols);
+    free(displs_cols);
+    free(packed_rows);
+    free(packed_cols);
+}
+
+// Nonlinear diffusion to time t with the additive operator splitting (AOS) scheme, in steps
+// steps of tau = t / steps:
+//   u <- ((I + 2 tau L_x(u))^-1 u + (I + 2 tau L_y(u))^-1 u) / 2
+// with L_x and L_y the row and column Laplacians whose Gaussian weights are taken from the
+// current u. Every step is one Thomas solve per image row and per image column. Rows are local
+// to the row blocks; for the columns the image is transposed to column blocks with
+// MPI_Alltoallv and back. The scheme is unconditionally stable, so a few large steps replace
+// many explicit iterations. u holds the rows [row_start, row_end) of this rank.
+void aos_diffusion(float *u, int width, int height, float t, int steps, float sigma, int rank, int size)
+{
+    int row_start, row_end, col_start, col_end;
+    block_rows(height, rank, size, 1, &row_start, &row_end);
+    block_rows(width, rank, size, 1, &col_start, &col_end);
+    int local_rows = row_end - row_start, local_cols = col_end - col_start;
+    float tau2 = 2.0f * t / steps;
+
+    float *v = (float *)malloc(((size_t)local_rows * width * 3 + 1) * sizeof(float));
+    float *cols = (float *)malloc(((size_t)local_cols * height * 3 + 1) * sizeof(float));
+    float *cols_v = (float *)malloc(((size_t)local_cols * height * 3 + 1) * sizeof(float));
+
+    for (int step = 0; step < steps; step++)
+    {
+        aos_transpose(u, cols, width, height, 1, rank, size);
+
+        #pragma omp parallel
+        {
+            int line = (width > height) ? width : height;
+            float *cp = (float *)malloc(line * sizeof(float));
+            float *dp = (float *)malloc(line * sizeof(float));
+
+            #pragma omp for schedule(static) nowait
+            for (int y = 0; y < local_rows; y++)
+                aos_line_solve(u + (size_t)y * width * 3, v + (size_t)y * width * 3, width, tau2, sigma, cp, dp);
+
+            #pragma omp for schedule(static)
+            for (int x = 0; x < local_cols; x++)
+                aos_line_solve(cols + (size_t)x * height * 3, cols_v + (size_t)x * height * 3, height, tau2, sigma,
+                               cp, dp);
+
+            free(cp);
+            free(dp);
+        }
+
+        // Column results back to row blocks (u is no longer needed), then average with the rows
+        aos_transpose(u, cols_v, width, height, 0, rank, size);
+        #pragma omp parallel for
+        for (int i = 0; i < local_rows * width * 3; i++)
+            u[i] = 0.5f * (u[i] + v[i]);
+    }
+
+    free(v);
+    free(cols);
+    free(cols_v);
+}
+
+enum
+{
+    SOLVER_CG,
+    SOLVER_MG,
+    SOLVER_CHEBYSHEV,
+    SOLVER_AOS
+};
+
+// Implicit graph-Laplacian denoising (MPI + OpenMP version): one backward Euler step of the
+// heat equation on the pixel graph, (I + t L) u = f, solved with preconditioned CG (Jacobi, or
+// a multigrid V-cycle for SOLVER_MG). Rows of the system are distributed over ranks in row
+// blocks; SpMV and vector updates are threaded with OpenMP. A large t smooths as much as many
+// explicit iterations at once. SOLVER_CHEBYSHEV instead applies the spectral filter
+// h(L) = exp(-t L) (or 1 / (1 + t L) with RESPONSE_TIKHONOV) with order Chebyshev terms.
+// SOLVER_AOS runs nonlinear diffusion to time t in steps AOS steps (aos_diffusion).
+void graph_laplacian_rgb_parallel(PPMImage *input, PPMImage *output, float t, float tolerance, int max_iterations,
+                                  int solver, int response, int order, int steps, int check, int rank, int size)
+{
+    int width = input->width, height = input->height;
+    float sigma = 20.0f;
+
+    // Multigrid needs row blocks aligned to its coarsest level
+    int levels = (solver == SOLVER_MG) ? mg_level_count(width, height, size) : 1;
+    int row_start, row_end;
+    block_rows(height, rank, size, 1 << (levels - 1), &row_start, &row_end);
+
+    int n = (row_end - row_start) * width;
+
+    float *f = (float *)malloc(n * 3 * sizeof(float));
+    float *u = (float *)malloc(n * 3 * sizeof(float));
+    unsigned char *local = (unsigned char *)malloc(n * 3);
+    const unsigned char *own = input->data + (size_t)row_start * width * 3;
+
+    #pragma omp parallel for
+    for (int i = 0; i < n * 3; i++)
+    {
+        f[i] = own[i];
+        u[i] = own[i];
+    }
+
+    if (solver == SOLVER_AOS)
+    {
+        if (rank == 0)
+            printf("AOS with %d steps of tau %g.\n", steps, t / steps);
+        aos_diffusion(u, width, height, t, steps, sigma, rank, size);
+    }
+    else if (solver == SOLVER_CHEBYSHEV)
+    {
+        GridLevel G;
+        int up = (rank > 0) ? rank - 1 : MPI_PROC_NULL;
+        int down = (rank < size - 1) ? rank + 1 : MPI_PROC_NULL;
+        grid_alloc(&G, width, height, row_start, row_end, up, down);
+        grid_build_fine(&G, input->data, 1.0f, sigma);
+        chebyshev_filter(&G, f, u, response, t, order, rank);
+        grid_free(&G);
+        if (check)
+            chebyshev_check(input->data, width, height, row_start, row_end, t, sigma, f, u, tolerance,
+                            max_iterations, rank, size);
+    }
+    else if (solver == SOLVER_MG)
+    {
+        CSRMatrix A = build_laplacian_system(input->data, width, height, row_start, row_end, t, sigma);
+        Multigrid *mg = mg_build(input->data, width, height, levels, t, sigma, rank, size);
+        if (rank == 0)
+            printf("Multigrid with %d levels, coarsest %dx%d.\n", levels, mg->coarse.width, mg->coarse.height);
+        pcg_solve(&A, f, u, tolerance, max_iterations, mg_precondition, mg, rank, size);
+        mg_free(mg);
+        free_csr(&A);
+    }
+    else
+    {
+        CSRMatrix A = build_laplacian_system(input->data, width, height, row_start, row_end, t, sigma);
+        // The diagonal is the first entry of every row
+        float *inv_diag = (float *)malloc(n * 3 * sizeof(float));
+        #pragma omp parallel for
+        for (int i = 0; i < n; i++)
+            for (int c = 0; c < 3; c++)
+                inv_diag[i * 3 + c] = 1.0f / A.values[A.row_ptr[i] * 3 + c];
+        pcg_solve(&A, f, u, tolerance, max_iterations, jacobi_precondition, inv_diag, rank, size);
+        free(inv_diag);
+        free_csr(&A);
+    }
+
+    #pragma omp parallel for
+    for (int i = 0; i < n * 3; i++)
+        local[i] = (unsigned char)(fminf(fmaxf(u[i] + 0.5f, 0), 255));
+
+    int *recvcounts = malloc(size * sizeof(int));
+    int *displs = malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++)
+    {
+        int start, end;
+        block_rows(height, i, size, 1 << (levels - 1), &start, &end);
+        recvcounts[i] = (end - start) * width * 3;
+        displs[i] = start * width * 3;
+    }
+    MPI_Gatherv(local, n * 3, MPI_UNSIGNED_CHAR, output->data, recvcounts, displs, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+
+    free(f);
+    free(u);
+    free(local);
+    free(recvcounts);
+    free(displs);
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+
+    double total_start_time = MPI_Wtime(); // Start timing for the entire program
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    if (argc < 4)
+    {
+        if (rank == 0)
+            printf("Usage: %s <input.ppm> <output.ppm> <t> [--solver=cg|mg|chebyshev|aos] [--tolerance=X] [--max-iterations=N]"
+                   " [--response=heat|tikhonov] [--order=K] [--steps=N] [--check]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    float t = atof(argv[3]);
+    float tolerance = 1e-3f;
+    int max_iterations = 500;
+    int solver = SOLVER_CG;
+    int response = RESPONSE_HEAT;
+    int order = 20;
+    int steps = 10;
+    int check = 0;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--solver=cg") == 0)
+            solver = SOLVER_CG;
+        else if (strcmp(argv[i], "--solver=mg") == 0)
+            solver = SOLVER_MG;
+        else if (strcmp(argv[i], "--solver=chebyshev") == 0)
+            solver = SOLVER_CHEBYSHEV;
+        else if (strcmp(argv[i], "--solver=aos") == 0)
+            solver = SOLVER_AOS;
+        else if (strncmp(argv[i], "--steps=", 8) == 0)
+            steps = atoi(argv[i] + 8);
+        else if (strcmp(argv[i], "--response=heat") == 0)
+            response = RESPONSE_HEAT;
+        else if (strcmp(argv[i], "--response=tikhonov") == 0)
+            response = RESPONSE_TIKHONOV;
+        else if (strcmp(argv[i], "--check") == 0)
+            check = 1;
+        else if (strncmp(argv[i], "--order=", 8) == 0)
+            order = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--tolerance=", 12) == 0)
+            tolerance = atof(argv[i] + 12);
+        else if (strncmp(argv[i], "--max-iterations=", 17) == 0)
+            max_iterations = atoi(argv[i] + 17);
+        else
+        {
+            if (rank == 0)
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            MPI_Finalize();
+            return 1;
+        }
+    }
+    if (t <= 0.0f || max_iterations <= 0 || steps <= 0 || order < 1 || order > 64)
+    {
+        if (rank == 0)
+            fprintf(stderr, "t, the iteration cap and the AOS steps must be positive, the Chebyshev order in 1..64.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    if (check && (solver != SOLVER_CHEBYSHEV || response != RESPONSE_TIKHONOV))
+    {
+        if (rank == 0)
+            fprintf(stderr, "--check compares --solver=chebyshev --response=tikhonov with the CG solve.\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    PPMImage *input = NULL, *output = NULL;
+    if (rank == 0)
+    {
+        input = read_ppm(argv[1]);
+        if (!input)
+        {
+            // Signal other processes to terminate gracefully
+            int error_flag = 1;
+            MPI_Bcast(&error_flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            MPI_Finalize();
+            return 1;
+        }
+        // Signal successful read
+        int error_flag = 0;
+        MPI_Bcast(&error_flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    else
+    {
+        // Wait for signal from rank 0
+        int error_flag;
+        MPI_Bcast(&error_flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (error_flag)
+        {
+            MPI_Finalize();
+            return 1;
+        }
+    }
+
+    int width, height;
+    if (rank == 0)
+    {
+        width = input->width;
+        height = input->height;
+    }
+    MPI_Bcast(&width, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&height, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    output = (PPMImage *)malloc(sizeof(PPMImage));
+    output->width = width;
+    output->height = height;
+    output->data = (unsigned char *)malloc(width * height * 3);
+
+    if (rank != 0)
+    {
+        input = (PPMImage *)malloc(sizeof(PPMImage));
+        input->width = width;
+        input->height = height;
+        input->data = (unsigned char *)malloc(width * height * 3);
+    }
+    MPI_Bcast(input->data, width * height * 3, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+
+    double compute_start_time = MPI_Wtime();
+    graph_laplacian_rgb_parallel(input, output, t, tolerance, max_iterations, solver, response, order, steps, check, rank, size);
+    double compute_end_time = MPI_Wtime();
+
+    if (rank == 0)
+    {
+        write_ppm(argv[2], output);
+    }
+
+    free(input->data);
+    free(input);
+    free(output->data);
+    free(output);
+
+    double total_end_time = MPI_Wtime(); // End timing for the entire program
+    if (rank == 0)
+    {
+        printf("Computation time (graph_laplacian_rgb_parallel) in %.4f seconds.\n", compute_end_time - compute_start_time);
+        printf("Total (Laplacian) execution time in %f seconds.\n", total_end_time - total_start_time);
+    }
+
+    MPI_Finalize();
+    return 0;
+}
@@ -1,6 +1,6 @@
 #!/bin/bash
 
-# Usage: ./run_denoise.sh <input_image> <noising_rate> <alpha> <iterations> <resize> <num_processes>
+# Usage: ./run_denoise.sh <input_image> <noising_rate> <alpha> <iterations> <resize> <num_processes> [graph options...]
 # Example: ./run_denoise.sh input.png 0.01 0.01 5 yes 4
 
 input_image=$1  # Accept input image name as an argument
@@ -9,33 +9,38 @@ alpha=$3  # Accept alpha as an argument
 iterations=$4  # Accept number of iterations as an argument
 resize=$5            # Resize option: "yes" or "no"
 num_processes=$6     # Number of MPI processes
+shift 6
+graph_options=("$@") # Extra options forwarded to graph_denoise_rgb
 
 # Set the number of OpenMP threads
 export OMP_NUM_THREADS=$num_processes
 
 output_prefix=${input_image%.*}  # Base name without extension
 
-# Conditional resize
+# The programs read and write PNG and PPM directly; ImageMagick is only needed to resize
+# the input or to convert other formats
+converted_input=""
 if [ "$resize" == "yes" ]; then
-    convert "$input_image" -resize 4096x4096 "${output_prefix}.ppm"
-else
-    convert "$input_image" "${output_prefix}.ppm"
+    converted_input="${output_prefix}_4096.png"
+    convert "$input_image" -resize 4096x4096 "$converted_input"
+elif [[ $input_image != *.png && $input_image != *.ppm ]]; then
+    converted_input="${output_prefix}_input.png"
+    convert "$input_image" "$converted_input"
 fi
+input_image=${converted_input:-$input_image}
 
-gcc -O3 -std=c99 -o add_noise add_noise.c -lm
+gcc -O3 -std=c99 -o add_noise add_noise.c -lpng -lm
 
-./add_noise "${output_prefix}.ppm" noisy_output.ppm "$noising_rate"
-
-convert noisy_output.ppm noisy_output.png
+./add_noise "$input_image" noisy_output.png "$noising_rate"
 
 # Run MPI-enabled graph-based denoising
-mpicc -O3 -std=c99 -fopenmp -o graph_denoise_rgb graph_denoise_rgb.c -lm
+mpicc -O3 -std=c99 -fopenmp -o graph_denoise_rgb graph_denoise_rgb.c -lpng -lm
 
 runs=10  # Number of runs for averaging
 total_sum=0
 
 for i in $(seq 1 $runs); do
-    output=$(mpirun -np "$num_processes" ./graph_denoise_rgb noisy_output.ppm graph_denoised_output.ppm "$alpha" "$iterations")
+    output=$(mpirun -np "$num_processes" ./graph_denoise_rgb noisy_output.png graph_denoised_output.png "$alpha" "$iterations" "${graph_options[@]}")
     # Extract the total value
     total_value=$(echo "$output" | grep -oP 'Total.*?in\s+\K[0-9.]+')
     # Add to the sum
@@ -46,15 +51,13 @@ done
 average=$(echo "scale=4; $total_sum / $runs" | bc)
 echo "Graph average over $runs runs: $average"
 
-convert graph_denoised_output.ppm graph_denoised_output.png
-
 # Run MPI-enabled median-based denoising
-mpicc -O3 -std=c99 -fopenmp -o median_denoise_rgb median_denoise_rgb.c -lm
+mpicc -O3 -std=c99 -fopenmp -o median_denoise_rgb median_denoise_rgb.c -lpng -lm
 
 total_sum=0
 
 for i in $(seq 1 $runs); do
-    output=$(mpirun -np "$num_processes" ./median_denoise_rgb noisy_output.ppm median_denoised_output.ppm)
+    output=$(mpirun -np "$num_processes" ./median_denoise_rgb noisy_output.png median_denoised_output.png)
     # Extract the total value
     total_value=$(echo "$output" | grep -oP 'Total.*?in\s+\K[0-9.]+')
     # Add to the sum
@@ -65,8 +68,6 @@ done
 average=$(echo "scale=4; $total_sum / $runs" | bc)
 echo "Median average over $runs runs: $average"
 
-convert median_denoised_output.ppm median_denoised_output.png
-
 # Clean up intermediate files
 rm -f graph_denoise_rgb median_denoise_rgb add_noise
-rm -f "${output_prefix}.ppm" noisy_output.ppm graph_denoised_output.ppm median_denoised_output.ppm
\ No newline at end of file
+[ -n "$converted_input" ] && rm -f "$converted_input"
\ No newline at end of file
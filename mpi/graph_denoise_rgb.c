@@ -1,6 +1,8 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <png.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
@@ -70,8 +72,155 @@ void write_ppm(const char *filename, PPMImage *img)
     fclose(fp);
 }
 
+// Read an 8-bit RGB image from a PNG file with the libpng simplified API; grey, palette,
+// 16-bit and alpha images are converted (alpha is composited onto black)
+PPMImage *read_png(const char *filename)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename))
+    {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        return NULL;
+    }
+    image.format = PNG_FORMAT_RGB;
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    img->width = image.width;
+    img->height = image.height;
+    img->data = (unsigned char *)calloc(PNG_IMAGE_SIZE(image), 1);
+    if (!png_image_finish_read(&image, NULL, img->data, 0, NULL))
+    {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        png_image_free(&image);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+// Write an 8-bit RGB PNG; returns 0 on success
+int write_png(const char *filename, PPMImage *img)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = img->width;
+    image.height = img->height;
+    image.format = PNG_FORMAT_RGB;
+    if (!png_image_write_to_file(&image, filename, 0, img->data, 0, NULL))
+    {
+        fprintf(stderr, "Error writing PNG %s: %s\n", filename, image.message);
+        return -1;
+    }
+    return 0;
+}
+
+// Files ending in ".png" (any case) are PNG, everything else PPM
+int is_png_file(const char *filename)
+{
+    size_t length = strlen(filename);
+    if (length < 4)
+        return 0;
+    const char *ext = filename + length - 4;
+    return ext[0] == '.' && tolower((unsigned char)ext[1]) == 'p' && tolower((unsigned char)ext[2]) == 'n' &&
+           tolower((unsigned char)ext[3]) == 'g';
+}
+
+PPMImage *read_image(const char *filename)
+{
+    return is_png_file(filename) ? read_png(filename) : read_ppm(filename);
+}
+
+// Returns 0 on success
+int write_image(const char *filename, PPMImage *img)
+{
+    if (is_png_file(filename))
+        return write_png(filename, img);
+    write_ppm(filename, img);
+    return 0;
+}
+
+// Fixed-point variant of the graph kernel. Weights are Q15 integers from a table indexed by
+// the absolute difference, alpha is Q8, and the weighted average, threshold test and update
+// are done in integer arithmetic with flooring divides. Results do not depend on FMA
+// contraction or the expf implementation, so every backend produces the same bits.
+#define FIXED_WEIGHT_BITS 15
+#define FIXED_ALPHA_BITS 8
+
+// Q15 Gaussian weight for every absolute difference 0..255. Computed in double and rounded,
+// so all backends get the same integers.
+void graph_fixed_weight_table(int table[256], float sigma)
+{
+    for (int d = 0; d < 256; d++)
+        table[d] = (int)floor(exp(-(double)(d * d) / (2.0 * sigma * sigma)) * (1 << FIXED_WEIGHT_BITS) + 0.5);
+}
+
+int graph_fixed_alpha(float alpha)
+{
+    return (int)floor((double)alpha * (1 << FIXED_ALPHA_BITS) + 0.5);
+}
+
+// num / den rounded down, like the float kernels' conversion to unsigned char (den > 0)
+static inline long long fixed_div_floor(long long num, long long den)
+{
+    return (num >= 0) ? num / den : -((-num + den - 1) / den);
+}
+
+// Integer counterpart of the float update
+static inline unsigned char graph_fixed_sample(int center, const int neighbors[4], const int *weight_table,
+                                               int alpha_q, int threshold)
+{
+    int weight_sum = 0, weighted_value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int weight = weight_table[abs(neighbors[i] - center)];
+        weight_sum += weight;
+        weighted_value += weight * neighbors[i];
+    }
+    if (weight_sum == 0)
+    {
+        // Every neighbour is more than ~94 levels away. The float weights are then dominated by the
+        // closest neighbours, so take their mean (always above the threshold).
+        int closest = 256;
+        for (int i = 0; i < 4; i++)
+        {
+            int diff = abs(neighbors[i] - center);
+            if (diff < closest)
+            {
+                closest = diff;
+                weight_sum = 0;
+                weighted_value = 0;
+            }
+            if (diff == closest)
+            {
+                weight_sum++;
+                weighted_value += neighbors[i];
+            }
+        }
+    }
+
+    // (smooth_value - center) scaled by weight_sum
+    long long deviation = weighted_value - (long long)center * weight_sum;
+    long long result;
+    if (llabs(deviation) > (long long)threshold * weight_sum)
+        result = fixed_div_floor(weighted_value, weight_sum);
+    else
+        result = fixed_div_floor(((long long)center * weight_sum << FIXED_ALPHA_BITS) + alpha_q * deviation,
+                                 (long long)weight_sum << FIXED_ALPHA_BITS);
+    return (unsigned char)(result < 0 ? 0 : (result > 255 ? 255 : result));
+}
+
 // Enhanced edge-aware graph diffusion (MPI version)
-void graph_diffusion_rgb_parallel(PPMImage *input, PPMImage *output, float alpha, int iterations, int rank, int size)
+// With tolerance >= 0 the loop stops early once the global mean absolute change per sample of an
+// iteration drops to the tolerance; iterations is then only a cap. The residual is reduced with
+// MPI_Iallreduce, overlapped with the image exchange, and logged by rank 0 (CSV if residual_log is
+// given, otherwise stdout). With fixed_point set, every sample goes through the integer kernel
+// graph_fixed_sample. Returns the iterations performed.
+int graph_diffusion_rgb_parallel(PPMImage *input, PPMImage *output, float alpha, int iterations,
+                                 float tolerance, FILE *residual_log, int fixed_point, int rank, int size)
 {
     int width = input->width, height = input->height;
     size_t image_size = width * height * 3 * sizeof(unsigned char);
@@ -79,6 +228,10 @@ void graph_diffusion_rgb_parallel(PPMImage *input, PPMImage *output, float alpha
     unsigned char *next = malloc(image_size);
     memcpy(curr, input->data, image_size);
 
+    int weight_table[256];
+    int alpha_q = graph_fixed_alpha(alpha);
+    graph_fixed_weight_table(weight_table, 20.0f);
+
     // Determine global block decomposition: each process works on rows [local_start, local_end)
     int rows_per_proc = height / size;
     int extra = height % size;
@@ -114,8 +267,16 @@ void graph_diffusion_rgb_parallel(PPMImage *input, PPMImage *output, float alpha
         displs[i] = eff_start * width * 3;
     }
 
+    double samples = (double)(width - 2) * (height - 2) * 3;
+    int track = tolerance >= 0.0f; // without a tolerance no residual is computed or reduced
+    int performed = 0;
+    if (rank == 0 && residual_log)
+        fprintf(residual_log, "iteration,changed,l1,residual\n");
+
     for (int iter = 0; iter < iterations; iter++)
     {
+        double local_change[2] = {0.0, 0.0}; // changed samples, L1 change
+        double changed = 0.0, l1 = 0.0;
         memcpy(next, curr, image_size);
         // Update only interior rows within the local block
         for (int y = local_eff_start; y < local_eff_end; y++)
@@ -131,33 +292,73 @@ void graph_diffusion_rgb_parallel(PPMImage *input, PPMImage *output, float alpha
                         curr[((y + 1) * width + x) * 3 + c],
                         curr[(y * width + (x - 1)) * 3 + c],
                         curr[(y * width + (x + 1)) * 3 + c]};
-                    float sigma = 20.0f, threshold = 20.0f;
-                    float weight_sum = 0.0f, weighted_value = 0.0f;
-                    for (int i = 0; i < 4; i++)
+                    if (fixed_point)
+                    {
+                        next[idx] = graph_fixed_sample(center, neighbors, weight_table, alpha_q, 20);
+                    }
+                    else
+                    {
+                        float sigma = 20.0f, threshold = 20.0f;
+                        float weight_sum = 0.0f, weighted_value = 0.0f;
+                        for (int i = 0; i < 4; i++)
+                        {
+                            float diff = neighbors[i] - center;
+                            float weight = expf(-(diff * diff) / (2 * sigma * sigma));
+                            weight_sum += weight;
+                            weighted_value += weight * neighbors[i];
+                        }
+                        float smooth_value = weighted_value / weight_sum;
+                        float diff_val = fabsf(smooth_value - center);
+                        float result = (diff_val > threshold) ? smooth_value : center + alpha * (smooth_value - center);
+                        next[idx] = (unsigned char)(fminf(fmaxf(result, 0), 255));
+                    }
+                    if (track)
                     {
-                        float diff = neighbors[i] - center;
-                        float weight = expf(-(diff * diff) / (2 * sigma * sigma));
-                        weight_sum += weight;
-                        weighted_value += weight * neighbors[i];
+                        int delta = abs(next[idx] - center);
+                        changed += (delta != 0);
+                        l1 += delta;
                     }
-                    float smooth_value = weighted_value / weight_sum;
-                    float diff_val = fabsf(smooth_value - center);
-                    float result = (diff_val > threshold) ? smooth_value : center + alpha * (smooth_value - center);
-                    next[idx] = (unsigned char)(fminf(fmaxf(result, 0), 255));
                 }
             }
         }
+        local_change[0] = changed;
+        local_change[1] = l1;
+
+        // Reduce the residual while the image exchange is in flight
+        double global_change[2];
+        MPI_Request residual_request = MPI_REQUEST_NULL;
+        if (track)
+            MPI_Iallreduce(local_change, global_change, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &residual_request);
+
         // Gather only the effective interior region from every process into the full image buffer
         MPI_Allgatherv(next + (local_eff_start * width * 3),
                        local_count, MPI_UNSIGNED_CHAR,
                        curr, recvcounts, displs, MPI_UNSIGNED_CHAR,
                        MPI_COMM_WORLD);
+        MPI_Wait(&residual_request, MPI_STATUS_IGNORE); // returns at once for MPI_REQUEST_NULL
+        performed = iter + 1;
+
+        if (track)
+        {
+            double residual = (samples > 0) ? global_change[1] / samples : 0.0;
+            if (rank == 0)
+            {
+                if (residual_log)
+                    fprintf(residual_log, "%d,%.0f,%.0f,%.6f\n", performed, global_change[0], global_change[1], residual);
+                else
+                    printf("Iteration %d: %.0f samples changed, residual %.6f\n", performed, global_change[0], residual);
+            }
+            // Every rank sees the same reduced residual, so all stop together
+            if (residual <= tolerance)
+                break;
+        }
     }
     memcpy(output->data, curr, image_size);
     free(curr);
     free(next);
     free(recvcounts);
     free(displs);
+    return performed;
 }
 
 int main(int argc, char *argv[])
@@ -170,16 +371,42 @@ int main(int argc, char *argv[])
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc != 5)
+    if (argc < 5)
     {
         if (rank == 0)
-            printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations>\n", argv[0]);
+            printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations> [--tolerance=X] [--max-iterations=N] [--residual-csv=file] [--fixed-point]\n", argv[0]);
         MPI_Finalize();
         return 1;
     }
 
     float alpha = atof(argv[3]);
     int iterations = atoi(argv[4]);
+
+    // Optional flags
+    float tolerance = -1.0f; // < 0: run the fixed number of iterations
+    const char *residual_csv = NULL;
+    int fixed_point = 0;
+    for (int i = 5; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--tolerance=", 12) == 0)
+            tolerance = atof(argv[i] + 12);
+        else if (strncmp(argv[i], "--max-iterations=", 17) == 0)
+            iterations = atoi(argv[i] + 17);
+        else if (strncmp(argv[i], "--residual-csv=", 15) == 0)
+            residual_csv = argv[i] + 15;
+        else if (strcmp(argv[i], "--fixed-point") == 0)
+            fixed_point = 1;
+        else
+        {
+            if (rank == 0)
+                fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            MPI_Finalize();
+            return 1;
+        }
+    }
+    if (residual_csv && tolerance < 0.0f)
+        tolerance = 0.0f; // log the residual, stop only at a fixed point
+
     if (iterations <= 0)
     {
         if (rank == 0)
@@ -188,15 +415,32 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    // A CSV that cannot be opened ends the run on every rank, as in the OpenMP program
+    FILE *residual_log = NULL;
+    int csv_error = 0;
+    if (rank == 0 && residual_csv && !(residual_log = fopen(residual_csv, "w")))
+    {
+        perror("Error opening residual CSV");
+        csv_error = 1;
+    }
+    MPI_Bcast(&csv_error, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (csv_error)
+    {
+        MPI_Finalize();
+        return 1;
+    }
+
     PPMImage *input = NULL, *output = NULL;
     if (rank == 0)
     {
-        input = read_ppm(argv[1]);
+        input = read_image(argv[1]);
         if (!input)
         {
             // Signal other processes to terminate gracefully
             int error_flag = 1;
             MPI_Bcast(&error_flag, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            if (residual_log)
+                fclose(residual_log);
             MPI_Finalize();
             return 1;
         }
@@ -242,12 +486,18 @@ int main(int argc, char *argv[])
     MPI_Bcast(input->data, width * height * 3, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
 
     double compute_start_time = MPI_Wtime();
-    graph_diffusion_rgb_parallel(input, output, alpha, iterations, rank, size);
+    int performed = graph_diffusion_rgb_parallel(input, output, alpha, iterations, tolerance, residual_log, fixed_point,
+                                                 rank, size);
     double compute_end_time = MPI_Wtime();
 
+    if (residual_log)
+        fclose(residual_log);
+    if (rank == 0 && tolerance >= 0.0f)
+        printf("Stopped after %d of at most %d iterations.\n", performed, iterations);
+
     if (rank == 0)
     {
-        write_ppm(argv[2], output);
+        write_image(argv[2], output);
     }
 
     // Free resources on all ranks
@@ -1,6 +1,8 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <png.h>
 #include <string.h>
 #include <time.h>
 
@@ -69,6 +71,77 @@ void write_ppm(const char *filename, PPMImage *img)
     fclose(fp);
 }
 
+// Read an 8-bit RGB image from a PNG file with the libpng simplified API; grey, palette,
+// 16-bit and alpha images are converted (alpha is composited onto black)
+PPMImage *read_png(const char *filename)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename))
+    {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        return NULL;
+    }
+    image.format = PNG_FORMAT_RGB;
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    img->width = image.width;
+    img->height = image.height;
+    img->data = (unsigned char *)calloc(PNG_IMAGE_SIZE(image), 1);
+    if (!png_image_finish_read(&image, NULL, img->data, 0, NULL))
+    {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        png_image_free(&image);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+// Write an 8-bit RGB PNG; returns 0 on success
+int write_png(const char *filename, PPMImage *img)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = img->width;
+    image.height = img->height;
+    image.format = PNG_FORMAT_RGB;
+    if (!png_image_write_to_file(&image, filename, 0, img->data, 0, NULL))
+    {
+        fprintf(stderr, "Error writing PNG %s: %s\n", filename, image.message);
+        return -1;
+    }
+    return 0;
+}
+
+// Files ending in ".png" (any case) are PNG, everything else PPM
+int is_png_file(const char *filename)
+{
+    size_t length = strlen(filename);
+    if (length < 4)
+        return 0;
+    const char *ext = filename + length - 4;
+    return ext[0] == '.' && tolower((unsigned char)ext[1]) == 'p' && tolower((unsigned char)ext[2]) == 'n' &&
+           tolower((unsigned char)ext[3]) == 'g';
+}
+
+PPMImage *read_image(const char *filename)
+{
+    return is_png_file(filename) ? read_png(filename) : read_ppm(filename);
+}
+
+// Returns 0 on success
+int write_image(const char *filename, PPMImage *img)
+{
+    if (is_png_file(filename))
+        return write_png(filename, img);
+    write_ppm(filename, img);
+    return 0;
+}
+
 // Median filter for RGB image (3x3 kernel) using MPI
 void median_filter_rgb_parallel(PPMImage *input, PPMImage *output, int rank, int size)
 {
@@ -147,7 +220,7 @@ int main(int argc, char *argv[])
     PPMImage *input = NULL, *output = NULL;
     if (rank == 0)
     {
-        input = read_ppm(argv[1]);
+        input = read_image(argv[1]);
         if (!input)
         {
             // Signal other processes to terminate gracefully
@@ -203,7 +276,7 @@ int main(int argc, char *argv[])
 
     if (rank == 0)
     {
-        write_ppm(argv[2], output);
+        write_image(argv[2], output);
     }
 
     // Free resources on all ranks
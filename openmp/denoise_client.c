@@ -0,0 +1,338 @@
+// Sends a PPM image to denoise_daemon and writes the filtered result, optionally repeating the
+// request to measure the per-request latency of the running daemon.
+#define _GNU_SOURCE // memfd_create under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <omp.h>
+
+typedef struct
+{
+    int width;
+    int height;
+    unsigned char *data; // RGB data stored as [R, G, B, R, G, B, ...]
+} PPMImage;
+
+// Wire format shared with denoise_daemon.cpp (host byte order)
+enum
+{
+    FILTER_MEDIAN = 0,
+    FILTER_GRAPH = 1
+};
+
+enum
+{
+    TRANSPORT_INLINE = 0,
+    TRANSPORT_SHM = 1
+};
+
+#define DENOISE_MAGIC 0x315a4e44u // "DNZ1"
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t filter;
+    uint32_t transport;
+    uint32_t width;
+    uint32_t height;
+    uint32_t iterations; // graph only
+    float alpha;         // graph only
+    uint32_t reserved;
+} RequestHeader;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t status; // 0 on success
+    uint32_t width;
+    uint32_t height;
+    uint64_t length; // bytes following the header
+} ResponseHeader;
+
+// Read PPM (P6 format)
+PPMImage *read_ppm(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        perror("Error opening file");
+        return NULL;
+    }
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    char version[3];
+    if (fscanf(fp, "%2s", version) != 1)
+    {
+        fprintf(stderr, "Error reading PPM version\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    if (version[1] != '6')
+    {
+        fprintf(stderr, "Only P6 supported\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+
+    int maxval;
+    if (fscanf(fp, "%d %d %d", &img->width, &img->height, &maxval) != 3)
+    {
+        fprintf(stderr, "Error reading image dimensions\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    if (maxval > 255)
+    {
+        fprintf(stderr, "%s has 16-bit samples (maxval %d); the daemon only filters 8-bit images\n", filename,
+                maxval);
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    fgetc(fp); // Skip newline
+
+    img->data = (unsigned char *)malloc(img->width * img->height * 3);
+    if (fread(img->data, 1, img->width * img->height * 3, fp) != img->width * img->height * 3)
+    {
+        fprintf(stderr, "Error reading image data\n");
+        fclose(fp);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    fclose(fp);
+    return img;
+}
+
+// Write PPM (P6 format); returns 0 on success
+int write_ppm(const char *filename, PPMImage *img)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        perror("Error opening output file");
+        return -1;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", img->width, img->height);
+    size_t size = (size_t)img->width * img->height * 3;
+    int status = (fwrite(img->data, 1, size, fp) == size) ? 0 : -1;
+    if (fclose(fp) != 0)
+        status = -1;
+    if (status != 0)
+        fprintf(stderr, "Error writing image data to %s\n", filename);
+    return status;
+}
+
+static int send_full(int fd, const void *buf, size_t bytes)
+{
+    while (bytes > 0)
+    {
+        ssize_t n = send(fd, buf, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf = (const char *)buf + n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+static int recv_full(int fd, void *buf, size_t bytes)
+{
+    while (bytes > 0)
+    {
+        ssize_t n = recv(fd, buf, bytes, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf = (char *)buf + n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+// One request over the connection fd. Inline: pixels are sent and the result is received into
+// result. Shared memory: shm_fd holds the pixels and is passed with the header; the daemon
+// filters them in place. Returns 0 on success.
+int denoise_request(int fd, const RequestHeader *request, const unsigned char *pixels, unsigned char *result,
+                    int shm_fd)
+{
+    size_t bytes = (size_t)request->width * request->height * 3;
+    struct iovec iov = {(void *)request, sizeof(*request)};
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    if (shm_fd >= 0)
+    {
+        // The descriptor travels with the header bytes
+        memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &shm_fd, sizeof(int));
+    }
+    ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    if (sent < 0 || send_full(fd, (const char *)request + sent, sizeof(*request) - sent) != 0 ||
+        (shm_fd < 0 && send_full(fd, pixels, bytes) != 0))
+    {
+        perror("Error sending request");
+        return -1;
+    }
+
+    ResponseHeader response;
+    if (recv_full(fd, &response, sizeof(response)) != 0 || response.magic != DENOISE_MAGIC)
+    {
+        fprintf(stderr, "Error receiving response\n");
+        return -1;
+    }
+    if (response.status != 0)
+    {
+        char error[256];
+        size_t length = response.length < sizeof(error) - 1 ? response.length : sizeof(error) - 1;
+        if (recv_full(fd, error, length) != 0)
+            length = 0;
+        error[length] = '\0';
+        fprintf(stderr, "Daemon error: %s\n", error);
+        return -1;
+    }
+    if (response.length != (shm_fd < 0 ? bytes : 0) || (response.length && recv_full(fd, result, bytes) != 0))
+    {
+        fprintf(stderr, "Error receiving image data\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        printf("Usage: %s <socket_path> <median|graph> <input.ppm> <output.ppm> [--alpha=X] [--iterations=N]"
+               " [--shm] [--repeat=N]\n",
+               argv[0]);
+        return 1;
+    }
+
+    RequestHeader request;
+    memset(&request, 0, sizeof(request));
+    request.magic = DENOISE_MAGIC;
+    request.transport = TRANSPORT_INLINE;
+    request.alpha = 0.1f;
+    request.iterations = 10;
+    if (strcmp(argv[2], "median") == 0)
+        request.filter = FILTER_MEDIAN;
+    else if (strcmp(argv[2], "graph") == 0)
+        request.filter = FILTER_GRAPH;
+    else
+    {
+        fprintf(stderr, "Unknown filter: %s\n", argv[2]);
+        return 1;
+    }
+    int repeat = 1;
+    for (int i = 5; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--alpha=", 8) == 0)
+            request.alpha = atof(argv[i] + 8);
+        else if (strncmp(argv[i], "--iterations=", 13) == 0)
+            request.iterations = atoi(argv[i] + 13);
+        else if (strcmp(argv[i], "--shm") == 0)
+            request.transport = TRANSPORT_SHM;
+        else if (strncmp(argv[i], "--repeat=", 9) == 0)
+            repeat = atoi(argv[i] + 9);
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (repeat <= 0)
+    {
+        fprintf(stderr, "The repeat count must be a positive integer.\n");
+        return 1;
+    }
+
+    PPMImage *input = read_ppm(argv[3]);
+    if (!input)
+        return 1;
+    request.width = input->width;
+    request.height = input->height;
+    size_t bytes = (size_t)input->width * input->height * 3;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        perror("Error connecting to daemon");
+        return 1;
+    }
+
+    // With --shm the image lives in a memfd that both processes map; every repetition starts
+    // again from the input
+    int shm_fd = -1;
+    unsigned char *shared = NULL;
+    unsigned char *result = (unsigned char *)malloc(bytes);
+    if (request.transport == TRANSPORT_SHM)
+    {
+        shm_fd = memfd_create("denoise", MFD_CLOEXEC);
+        if (shm_fd < 0 || ftruncate(shm_fd, bytes) != 0)
+        {
+            perror("Error creating shared memory");
+            return 1;
+        }
+        shared = (unsigned char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        if (shared == MAP_FAILED)
+        {
+            perror("Error mapping shared memory");
+            return 1;
+        }
+    }
+
+    double total = 0.0, best = 0.0;
+    for (int r = 0; r < repeat; r++)
+    {
+        if (shared)
+            memcpy(shared, input->data, bytes);
+        double start = omp_get_wtime();
+        if (denoise_request(fd, &request, input->data, result, shm_fd) != 0)
+            return 1;
+        double elapsed = omp_get_wtime() - start;
+        total += elapsed;
+        if (r == 0 || elapsed < best)
+            best = elapsed;
+    }
+    if (shared)
+        memcpy(result, shared, bytes);
+    printf("%d requests: %.2f ms average, %.2f ms best.\n", repeat, total / repeat * 1000.0, best * 1000.0);
+
+    PPMImage output = {input->width, input->height, result};
+    int status = write_ppm(argv[4], &output);
+    if (shared)
+    {
+        munmap(shared, bytes);
+        close(shm_fd);
+    }
+    close(fd);
+    free(result);
+    free(input->data);
+    free(input);
+    return status == 0 ? 0 : 1;
+}
@@ -0,0 +1,710 @@
+// Long-running denoise service on a UNIX domain socket. Clients send a request naming the
+// filter (median or graph) and its parameters, with the RGB pixels either inline after the
+// request or in a shared-memory fd passed along with it; the reply carries the filtered pixels
+// (inline) or reports that the shared memory now holds them. Process start-up, the OpenMP thread
+// teams and the weight table are paid once instead of per image, and no file is read or written.
+//
+// One thread runs an epoll loop in which every connection is a C++20 coroutine; a coroutine
+// that needs more bytes, socket space or a finished job suspends and is resumed by the loop.
+// Filtering happens in a shared pool of worker threads, each with its own share of the OpenMP
+// threads. The kernels are those of graph_denoise_rgb.c (plain ping-pong schedule) and
+// median_denoise_rgb.c, with the same results.
+//
+// Build: g++ -O3 -std=c++20 -fopenmp -o denoise_daemon denoise_daemon.cpp
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <coroutine>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <omp.h>
+
+// Wire format, in host byte order (both ends are on the same machine). A request is a
+// RequestHeader, followed for TRANSPORT_INLINE by width * height * 3 RGB bytes; for
+// TRANSPORT_SHM the message carrying the header also carries an fd (SCM_RIGHTS) of at least
+// that size, whose pixels are replaced by the result in place. The reply is a ResponseHeader
+// followed by length bytes: the filtered pixels for an inline request, nothing for a shared-
+// memory request, or an error message if status is not 0. denoise_client.c speaks the same.
+enum
+{
+    FILTER_MEDIAN = 0,
+    FILTER_GRAPH = 1
+};
+
+enum
+{
+    TRANSPORT_INLINE = 0,
+    TRANSPORT_SHM = 1
+};
+
+static const uint32_t DENOISE_MAGIC = 0x315a4e44; // "DNZ1"
+
+// Largest accepted image (bytes of RGB data)
+static const size_t MAX_IMAGE_BYTES = (size_t)1 << 30;
+
+struct RequestHeader
+{
+    uint32_t magic;
+    uint32_t filter;
+    uint32_t transport;
+    uint32_t width;
+    uint32_t height;
+    uint32_t iterations; // graph only
+    float alpha;         // graph only
+    uint32_t reserved;
+};
+
+struct ResponseHeader
+{
+    uint32_t magic;
+    uint32_t status; // 0 on success
+    uint32_t width;
+    uint32_t height;
+    uint64_t length; // bytes following the header
+};
+
+// Gaussian weight of a graph edge whose endpoints differ by diff
+static inline float graph_edge_weight(float diff, float sigma)
+{
+    return expf(-(diff * diff) / (2 * sigma * sigma));
+}
+
+// One ping-pong step of the graph kernel (graph_sample_step_u8 of graph_denoise_rgb.c), inside
+// an enclosing parallel region
+static void graph_step(const unsigned char *src, unsigned char *dst, int width, int height, const float *weight_lut,
+                       float alpha, float threshold)
+{
+    #pragma omp for
+    for (int y = 1; y < height - 1; y++)
+    {
+        for (int x = 1; x < width - 1; x++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                size_t idx = ((size_t)y * width + x) * 3 + c;
+                float center = src[idx];
+                float neighbors[4] = {(float)src[idx - (size_t)width * 3], (float)src[idx + (size_t)width * 3],
+                                      (float)src[idx - 3], (float)src[idx + 3]};
+
+                float weight_sum = 0.0f, weighted_value = 0.0f;
+                for (int i = 0; i < 4; i++)
+                {
+                    float weight = weight_lut[abs((int)neighbors[i] - (int)center)];
+                    weight_sum += weight;
+                    weighted_value += weight * neighbors[i];
+                }
+
+                float smooth_value = weighted_value / weight_sum;
+                float diff = fabsf(smooth_value - center);
+
+                float result = (diff > threshold) ? smooth_value : center + alpha * (smooth_value - center);
+                dst[idx] = (unsigned char)fminf(fmaxf(result, 0), 255.0f);
+            }
+        }
+    }
+}
+
+// Graph diffusion of pixels in place; scratch is the second ping-pong buffer
+static void graph_filter(unsigned char *pixels, std::vector<unsigned char> &scratch, int width, int height,
+                         float alpha, int iterations, const float *weight_lut)
+{
+    size_t bytes = (size_t)width * height * 3;
+    scratch.resize(bytes);
+    memcpy(scratch.data(), pixels, bytes); // the (never updated) border must be valid in both
+    unsigned char *curr = pixels, *next = scratch.data();
+
+    #pragma omp parallel
+    {
+        for (int iter = 0; iter < iterations; iter++)
+        {
+            graph_step(curr, next, width, height, weight_lut, alpha, 20.0f);
+            #pragma omp single
+            std::swap(curr, next);
+        }
+    }
+    if (curr != pixels)
+        memcpy(pixels, curr, bytes);
+}
+
+// Compare-exchange pairs of the 19-comparator median-of-9 selection network; afterwards
+// element 4 holds the median
+static const int median9_network[19][2] = {
+    {1, 2}, {4, 5}, {7, 8}, {0, 1}, {3, 4}, {6, 7}, {1, 2}, {4, 5}, {7, 8}, {0, 3},
+    {5, 8}, {4, 7}, {3, 6}, {1, 4}, {2, 5}, {4, 7}, {4, 2}, {6, 4}, {4, 2}};
+
+// 3x3 median of pixels in place; border pixels keep their values. A row is walked as one run of
+// interleaved samples whose horizontal neighbours are 3 apart, and the fully unrolled network
+// keeps the window in registers, so the compiler vectorises across samples.
+static void median_filter(unsigned char *pixels, std::vector<unsigned char> &scratch, int width, int height)
+{
+    size_t bytes = (size_t)width * height * 3;
+    scratch.resize(bytes);
+    memcpy(scratch.data(), pixels, bytes);
+    const unsigned char *src = scratch.data();
+    size_t stride = (size_t)width * 3;
+
+    #pragma omp parallel for
+    for (int y = 1; y < height - 1; y++)
+    {
+        const unsigned char *above = src + (y - 1) * stride, *row = src + y * stride, *below = src + (y + 1) * stride;
+        unsigned char *out = pixels + y * stride;
+        for (size_t i = 3; i + 3 < stride; i++)
+        {
+            unsigned char window[9] = {above[i - 3], above[i], above[i + 3], row[i - 3], row[i],
+                                       row[i + 3],   below[i - 3], below[i], below[i + 3]};
+            #pragma GCC unroll 19
+            for (int k = 0; k < 19; k++)
+            {
+                unsigned char a = window[median9_network[k][0]], b = window[median9_network[k][1]];
+                window[median9_network[k][0]] = a < b ? a : b;
+                window[median9_network[k][1]] = a < b ? b : a;
+            }
+            out[i] = window[4];
+        }
+    }
+}
+
+// Coroutine returning a T to the coroutine that co_awaits it. Starts suspended, runs when
+// awaited and resumes the awaiting coroutine directly when it finishes.
+template <typename T>
+class Task
+{
+public:
+    struct promise_type
+    {
+        T value{};
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+            {
+                return handle.promise().continuation;
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T result) { value = std::move(result); }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task(const Task &) = delete;
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return std::move(handle.promise().value); }
+
+private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Coroutine nobody awaits (the accept loop and the connections); runs at once and frees
+// itself when it returns
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Coroutine suspended until its file descriptor is ready
+struct Waiter
+{
+    std::coroutine_handle<> handle;
+};
+
+class EventLoop
+{
+public:
+    EventLoop()
+    {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        watch_fd(wake_fd, &wake_waiter, EPOLLIN);
+    }
+
+    ~EventLoop()
+    {
+        close(wake_fd);
+        close(epoll_fd);
+    }
+
+    bool ok() const { return epoll_fd >= 0 && wake_fd >= 0; }
+
+    // Edge-triggered for reading and writing: the coroutine tries its I/O first and only waits
+    // after EAGAIN, so no readiness is missed
+    void watch(int fd, Waiter *waiter) { watch_fd(fd, waiter, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET); }
+    void unwatch(int fd) { epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL); }
+
+    // Stop the loop when fd (a signalfd) becomes readable
+    void stop_on(int fd) { watch_fd(fd, &stop_waiter, EPOLLIN); }
+
+    // co_await loop.ready(waiter): suspend until the watched descriptor reports an event
+    struct ReadyAwaiter
+    {
+        Waiter &waiter;
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { waiter.handle = handle; }
+        void await_resume() {}
+    };
+    ReadyAwaiter ready(Waiter &waiter) { return {waiter}; }
+
+    // Called from worker threads: resume handle on the loop thread
+    void complete(std::coroutine_handle<> handle)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(handle);
+        }
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("Error waking event loop");
+    }
+
+    void run()
+    {
+        epoll_event events[64];
+        for (;;)
+        {
+            int n = epoll_wait(epoll_fd, events, 64, -1);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("epoll_wait");
+                return;
+            }
+            bool woken = false;
+            for (int i = 0; i < n; i++)
+            {
+                Waiter *waiter = (Waiter *)events[i].data.ptr;
+                if (waiter == &stop_waiter)
+                    return;
+                if (waiter == &wake_waiter)
+                {
+                    woken = true;
+                    continue;
+                }
+                // A resumed coroutine may finish and free its own waiter, never another one
+                std::coroutine_handle<> handle = std::exchange(waiter->handle, nullptr);
+                if (handle)
+                    handle.resume();
+            }
+            // Finished jobs are resumed after the socket events, since a connection they
+            // resume may end and free a waiter that is still in events
+            if (woken)
+            {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                    perror("Error reading wake-up counter");
+                std::vector<std::coroutine_handle<>> resume;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    resume.swap(finished);
+                }
+                for (std::coroutine_handle<> handle : resume)
+                    handle.resume();
+            }
+        }
+    }
+
+private:
+    void watch_fd(int fd, Waiter *waiter, uint32_t events)
+    {
+        epoll_event event;
+        event.events = events;
+        event.data.ptr = waiter;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            perror("epoll_ctl");
+    }
+
+    int epoll_fd;
+    int wake_fd;
+    Waiter wake_waiter, stop_waiter;
+    std::mutex mutex;
+    std::vector<std::coroutine_handle<>> finished;
+};
+
+// One filter run, owned by the connection that submitted it
+struct Job
+{
+    int filter;
+    unsigned char *pixels;
+    int width, height;
+    float alpha;
+    int iterations;
+    std::coroutine_handle<> handle;
+};
+
+// Worker threads shared by all connections. Each worker runs one job at a time on
+// threads_per_worker OpenMP threads, reusing its scratch buffer across jobs.
+class WorkerPool
+{
+public:
+    WorkerPool(EventLoop &loop, int workers, int threads_per_worker) : loop(loop)
+    {
+        for (int d = 0; d < 256; d++)
+            weight_lut[d] = graph_edge_weight(d, 20.0f);
+        for (int i = 0; i < workers; i++)
+            threads.emplace_back([this, threads_per_worker] { work(threads_per_worker); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    // co_await pool.run(job): filter on a worker, continue on the loop thread when done
+    struct RunAwaiter
+    {
+        WorkerPool &pool;
+        Job &job;
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            job.handle = handle;
+            {
+                std::lock_guard<std::mutex> lock(pool.mutex);
+                pool.queue.push_back(&job);
+            }
+            pool.wake.notify_one();
+        }
+        void await_resume() {}
+    };
+    RunAwaiter run(Job &job) { return {*this, job}; }
+
+private:
+    void work(int threads_per_worker)
+    {
+        omp_set_num_threads(threads_per_worker);
+        std::vector<unsigned char> scratch;
+        for (;;)
+        {
+            Job *job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping)
+                    return;
+                job = queue.front();
+                queue.pop_front();
+            }
+            if (job->filter == FILTER_GRAPH)
+                graph_filter(job->pixels, scratch, job->width, job->height, job->alpha, job->iterations, weight_lut);
+            else
+                median_filter(job->pixels, scratch, job->width, job->height);
+            loop.complete(job->handle);
+        }
+    }
+
+    EventLoop &loop;
+    float weight_lut[256];
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job *> queue;
+    bool stopping = false;
+};
+
+// Receive exactly bytes into buffer; a descriptor passed along (SCM_RIGHTS) is stored in
+// *passed_fd if that is not NULL and still -1, and closed otherwise. False on EOF or error.
+Task<bool> receive_all(EventLoop &loop, int fd, Waiter &waiter, void *buffer, size_t bytes, int *passed_fd)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        iovec iov = {(char *)buffer + done, bytes - done};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(fd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            co_await loop.ready(waiter);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            co_return false;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+            if (passed_fd && *passed_fd < 0)
+                *passed_fd = received;
+            else
+                close(received);
+        }
+        done += n;
+    }
+    co_return true;
+}
+
+// Send exactly bytes from buffer; false if the peer is gone
+Task<bool> send_all(EventLoop &loop, int fd, Waiter &waiter, const void *buffer, size_t bytes)
+{
+    size_t done = 0;
+    while (done < bytes)
+    {
+        ssize_t n = send(fd, (const char *)buffer + done, bytes - done, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            co_await loop.ready(waiter);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            co_return false;
+        done += n;
+    }
+    co_return true;
+}
+
+// Shared-memory pixels of one request, unmapped and closed when the request is done
+struct SharedPixels
+{
+    int fd = -1;
+    void *base = MAP_FAILED;
+    size_t length = 0;
+
+    ~SharedPixels()
+    {
+        if (base != MAP_FAILED)
+            munmap(base, length);
+        if (fd >= 0)
+            close(fd);
+    }
+};
+
+// Validate a request header; NULL if it can be served
+static const char *check_request(const RequestHeader &request)
+{
+    if (request.magic != DENOISE_MAGIC)
+        return "bad magic";
+    if (request.filter != FILTER_MEDIAN && request.filter != FILTER_GRAPH)
+        return "unknown filter";
+    if (request.transport != TRANSPORT_INLINE && request.transport != TRANSPORT_SHM)
+        return "unknown transport";
+    if (request.width == 0 || request.height == 0 || request.width > 65535 || request.height > 65535 ||
+        (size_t)request.width * request.height * 3 > MAX_IMAGE_BYTES)
+        return "bad image size";
+    if (request.filter == FILTER_GRAPH && (request.iterations == 0 || request.iterations > 100000))
+        return "iterations must be between 1 and 100000";
+    return NULL;
+}
+
+// Serve the requests of one client, in order, until it disconnects or sends a bad request
+Detached serve_connection(EventLoop &loop, WorkerPool &pool, int fd)
+{
+    Waiter waiter;
+    loop.watch(fd, &waiter);
+    std::vector<unsigned char> inline_pixels;
+    for (;;)
+    {
+        RequestHeader request;
+        SharedPixels shared;
+        if (!co_await receive_all(loop, fd, waiter, &request, sizeof(request), &shared.fd))
+            break;
+
+        const char *error = check_request(request);
+        if (!error && request.transport == TRANSPORT_SHM && shared.fd < 0)
+            error = "no shared-memory fd passed with the request";
+        size_t bytes = (size_t)request.width * request.height * 3;
+        unsigned char *pixels = NULL;
+        if (!error && request.transport == TRANSPORT_INLINE)
+        {
+            inline_pixels.resize(bytes);
+            if (!co_await receive_all(loop, fd, waiter, inline_pixels.data(), bytes, NULL))
+                break;
+            pixels = inline_pixels.data();
+        }
+        else if (!error)
+        {
+            struct stat st;
+            if (fstat(shared.fd, &st) != 0 || (size_t)st.st_size < bytes)
+                error = "shared memory is smaller than the image";
+            else
+            {
+                shared.length = bytes;
+                shared.base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shared.fd, 0);
+                if (shared.base == MAP_FAILED)
+                    error = "cannot map the shared memory";
+                pixels = (unsigned char *)shared.base;
+            }
+        }
+
+        if (!error)
+        {
+            Job job = {(int)request.filter, pixels, (int)request.width, (int)request.height, request.alpha,
+                       (int)request.iterations, nullptr};
+            co_await pool.run(job);
+        }
+
+        ResponseHeader response = {DENOISE_MAGIC, error ? 1u : 0u, request.width, request.height, 0};
+        const void *payload = NULL;
+        if (error)
+        {
+            payload = error;
+            response.length = strlen(error);
+        }
+        else if (request.transport == TRANSPORT_INLINE)
+        {
+            payload = pixels;
+            response.length = bytes;
+        }
+        if (!co_await send_all(loop, fd, waiter, &response, sizeof(response)) ||
+            !co_await send_all(loop, fd, waiter, payload, response.length))
+            break;
+        // After a bad header the stream position is unknown, so the connection ends
+        if (error && check_request(request))
+            break;
+    }
+    loop.unwatch(fd);
+    close(fd);
+}
+
+Detached accept_connections(EventLoop &loop, WorkerPool &pool, int listen_fd)
+{
+    Waiter waiter;
+    loop.watch(listen_fd, &waiter);
+    for (;;)
+    {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0)
+            serve_connection(loop, pool, fd);
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            co_await loop.ready(waiter);
+        else if (errno != EINTR && errno != ECONNABORTED)
+        {
+            perror("accept");
+            co_await loop.ready(waiter); // e.g. out of descriptors: retry on the next connection
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <socket_path> [--workers=N]\n", argv[0]);
+        return 1;
+    }
+    const char *socket_path = argv[1];
+    int workers = 1;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--workers=", 10) == 0)
+            workers = atoi(argv[i] + 10);
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (workers <= 0)
+    {
+        fprintf(stderr, "The number of workers must be a positive integer.\n");
+        return 1;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    unlink(socket_path);
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 128) != 0)
+    {
+        perror("Error creating socket");
+        return 1;
+    }
+
+    // SIGINT and SIGTERM end the loop through a signalfd, so the socket file is removed
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    int threads = omp_get_max_threads();
+    int threads_per_worker = threads / workers > 0 ? threads / workers : 1;
+    printf("Listening on %s with %d workers of %d OpenMP threads.\n", socket_path, workers, threads_per_worker);
+    fflush(stdout);
+
+    {
+        EventLoop loop;
+        if (!loop.ok() || signal_fd < 0)
+        {
+            perror("Error creating event loop");
+            return 1;
+        }
+        loop.stop_on(signal_fd);
+        WorkerPool pool(loop, workers, threads_per_worker);
+        accept_connections(loop, pool, listen_fd);
+        loop.run();
+    }
+
+    close(listen_fd);
+    close(signal_fd);
+    unlink(socket_path);
+    return 0;
+}
@@ -1,144 +1,2021 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
-#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <omp.h> // Include OpenMP header
+#include "image_io.h"
 
+// Write img to filename, through a shared mapping of the new file if use_mmap is set. The
+// diffusion engines own and swap their buffers, so the result is copied into the mapping by all
+// threads in parallel rather than written by one fwrite. Returns 0 on success.
+int store_ppm(const char *filename, PPMImage *img, int use_mmap)
+{
+    if (!use_mmap)
+        return write_image(filename, img);
+
+    PPMImage *mapped = create_mapped_ppm(filename, img->width, img->height);
+    if (!mapped)
+        return -1;
+    size_t row_bytes = (size_t)img->width * 3;
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < img->height; y++)
+        memcpy(mapped->data + y * row_bytes, img->data + y * row_bytes, row_bytes);
+    return unmap_ppm(mapped);
+}
+
+// Gaussian weight of a graph edge whose endpoints differ by diff. diff * diff does not depend
+// on the direction, so (p, q) and (q, p) get bit-identical weights.
+static inline float graph_edge_weight(float diff, float sigma)
+{
+    return expf(-(diff * diff) / (2 * sigma * sigma));
+}
+
+// Weighted average of the four neighbours (up, down, left, right) and the thresholded update
+static inline unsigned char graph_combine_sample(int center, const int neighbors[4], const float weights[4],
+                                                 float alpha, float threshold)
+{
+    float weight_sum = 0.0f, weighted_value = 0.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        weight_sum += weights[i];
+        weighted_value += weights[i] * neighbors[i];
+    }
+
+    float smooth_value = weighted_value / weight_sum;
+    float diff = fabsf(smooth_value - center);
+
+    float result = (diff > threshold) ? smooth_value : center + alpha * (smooth_value - center);
+    return (unsigned char)(fminf(fmaxf(result, 0), 255));
+}
+
+// Edge-aware update of one channel sample. row_stride is the byte distance between rows
+// of src, so the same code runs on the full image and on the tile buffers below.
+static inline unsigned char graph_update_sample(const unsigned char *src, int idx, int row_stride,
+                                                float alpha, float sigma, float threshold)
+{
+    int center = src[idx];
+
+    int neighbors[4] = {
+        src[idx - row_stride],
+        src[idx + row_stride],
+        src[idx - 3],
+        src[idx + 3]};
+
+    float weights[4];
+    for (int i = 0; i < 4; i++)
+        weights[i] = graph_edge_weight(neighbors[i] - center, sigma);
+
+    return graph_combine_sample(center, neighbors, weights, alpha, threshold);
+}
+
+// Fixed-point variant of the graph kernel. Weights are Q15 integers from a table indexed by
+// the absolute difference, alpha is Q8, and the weighted average, threshold test and update
+// are done in integer arithmetic with flooring divides. Results do not depend on FMA
+// contraction or the expf implementation, so every backend produces the same bits.
+#define FIXED_WEIGHT_BITS 15
+#define FIXED_ALPHA_BITS 8
+
+// Q15 Gaussian weight for every absolute difference 0..255. Computed in double and rounded,
+// so all backends get the same integers.
+void graph_fixed_weight_table(int table[256], float sigma)
+{
+    for (int d = 0; d < 256; d++)
+        table[d] = (int)floor(exp(-(double)(d * d) / (2.0 * sigma * sigma)) * (1 << FIXED_WEIGHT_BITS) + 0.5);
+}
+
+int graph_fixed_alpha(float alpha)
+{
+    return (int)floor((double)alpha * (1 << FIXED_ALPHA_BITS) + 0.5);
+}
+
+// num / den rounded down, like the float kernels' conversion to unsigned char (den > 0)
+static inline long long fixed_div_floor(long long num, long long den)
+{
+    return (num >= 0) ? num / den : -((-num + den - 1) / den);
+}
+
+// Integer counterpart of the float update
+static inline unsigned char graph_fixed_sample(int center, const int neighbors[4], const int *weight_table,
+                                               int alpha_q, int threshold)
+{
+    int weight_sum = 0, weighted_value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int weight = weight_table[abs(neighbors[i] - center)];
+        weight_sum += weight;
+        weighted_value += weight * neighbors[i];
+    }
+    if (weight_sum == 0)
+    {
+        // Every neighbour is more than ~94 levels away. The float weights are then dominated by the
+        // closest neighbours, so take their mean (always above the threshold).
+        int closest = 256;
+        for (int i = 0; i < 4; i++)
+        {
+            int diff = abs(neighbors[i] - center);
+            if (diff < closest)
+            {
+                closest = diff;
+                weight_sum = 0;
+                weighted_value = 0;
+            }
+            if (diff == closest)
+            {
+                weight_sum++;
+                weighted_value += neighbors[i];
+            }
+        }
+    }
+
+    // (smooth_value - center) scaled by weight_sum
+    long long deviation = weighted_value - (long long)center * weight_sum;
+    long long result;
+    if (llabs(deviation) > (long long)threshold * weight_sum)
+        result = fixed_div_floor(weighted_value, weight_sum);
+    else
+        result = fixed_div_floor(((long long)center * weight_sum << FIXED_ALPHA_BITS) + alpha_q * deviation,
+                                 (long long)weight_sum << FIXED_ALPHA_BITS);
+    return (unsigned char)(result < 0 ? 0 : (result > 255 ? 255 : result));
+}
+
+// Per-channel edge weights of the 4-connected pixel graph for one image row, covering the
+// pixels x0..x1-1. Each weight is evaluated once and shared by both endpoints of the edge.
+typedef struct
+{
+    int capacity;      // pixels per row the buffers can hold
+    float *horizontal; // horizontal[(x - x0 + 1) * 3 + c]: edge (x, y)-(x + 1, y), x in [x0 - 1, x1)
+    float *up;         // up[(x - x0) * 3 + c]: edge (x, y - 1)-(x, y)
+    float *down;       // down[(x - x0) * 3 + c]: edge (x, y)-(x, y + 1)
+} GraphEdgeRow;
+
+GraphEdgeRow graph_edge_row_alloc(int capacity)
+{
+    GraphEdgeRow edges;
+    edges.capacity = capacity;
+    edges.horizontal = (float *)malloc((capacity + 1) * 3 * sizeof(float));
+    edges.up = (float *)malloc(capacity * 3 * sizeof(float));
+    edges.down = (float *)malloc(capacity * 3 * sizeof(float));
+    return edges;
+}
+
+void graph_edge_row_free(GraphEdgeRow *edges)
+{
+    free(edges->horizontal);
+    free(edges->up);
+    free(edges->down);
+}
+
+// Weights of the vertical edges between row and row_below for pixels x0..x1-1
+void graph_edge_weights_vertical(const unsigned char *row, const unsigned char *row_below,
+                                 int x0, int x1, float sigma, float *weights)
+{
+    for (int k = 0; k < (x1 - x0) * 3; k++)
+        weights[k] = graph_edge_weight(row_below[x0 * 3 + k] - row[x0 * 3 + k], sigma);
+}
+
+// Weights of the horizontal edges (x, x + 1) of row for x in [x0 - 1, x1)
+void graph_edge_weights_horizontal(const unsigned char *row, int x0, int x1, float sigma, float *weights)
+{
+    for (int k = 0; k < (x1 - x0 + 1) * 3; k++)
+        weights[k] = graph_edge_weight(row[(x0 - 1) * 3 + k + 3] - row[(x0 - 1) * 3 + k], sigma);
+}
+
+// Edge-centric diffusion step over the rectangle [x0, x1) x [y0, y1) of src (which must have a
+// one-pixel border around it). The horizontal edges of a row and the vertical edges below it are
+// computed once into edges, so every edge weight costs one expf instead of two. The down buffer of
+// one row becomes the up buffer of the next. Produces the same samples as graph_update_sample.
+// The number of changed samples and their L1 change are added to *changed and *l1, unless
+// changed is NULL.
+void graph_diffusion_rows_edge(const unsigned char *src, unsigned char *dst, int row_stride,
+                               int x0, int x1, int y0, int y1, float alpha, float sigma, float threshold,
+                               GraphEdgeRow *edges, long long *changed, double *l1)
+{
+    long long local_changed = 0;
+    long long local_l1 = 0;
+
+    graph_edge_weights_vertical(src + (y0 - 1) * row_stride, src + y0 * row_stride, x0, x1, sigma, edges->up);
+    for (int y = y0; y < y1; y++)
+    {
+        const unsigned char *row = src + y * row_stride;
+        graph_edge_weights_vertical(row, row + row_stride, x0, x1, sigma, edges->down);
+        graph_edge_weights_horizontal(row, x0, x1, sigma, edges->horizontal);
+
+        for (int x = x0; x < x1; x++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                int k = (x - x0) * 3 + c;
+                int idx = x * 3 + c;
+                int center = row[idx];
+                int neighbors[4] = {
+                    row[idx - row_stride],
+                    row[idx + row_stride],
+                    row[idx - 3],
+                    row[idx + 3]};
+                float weights[4] = {
+                    edges->up[k],
+                    edges->down[k],
+                    edges->horizontal[k],
+                    edges->horizontal[k + 3]};
+
+                unsigned char value = graph_combine_sample(center, neighbors, weights, alpha, threshold);
+                if (changed)
+                {
+                    int delta = abs(value - center);
+                    local_changed += (delta != 0);
+                    local_l1 += delta;
+                }
+                dst[y * row_stride + idx] = value;
+            }
+        }
+
+        float *swap = edges->up;
+        edges->up = edges->down;
+        edges->down = swap;
+    }
+
+    if (changed)
+    {
+        *changed += local_changed;
+        *l1 += local_l1;
+    }
+}
+
+// Enhanced edge-aware graph diffusion - Parallelized with OpenMP
+// One sample of the default pixel kernel: graph_update_sample, or graph_fixed_sample with
+// fixed_point set
+static inline unsigned char graph_pixel_sample(const unsigned char *src, int idx, int row_stride, float alpha,
+                                               float sigma, float threshold, int fixed_point,
+                                               const int *weight_table, int alpha_q)
+{
+    if (fixed_point)
+    {
+        int neighbors[4] = {src[idx - row_stride], src[idx + row_stride], src[idx - 3], src[idx + 3]};
+        return graph_fixed_sample(src[idx], neighbors, weight_table, alpha_q, (int)threshold);
+    }
+    return graph_update_sample(src, idx, row_stride, alpha, sigma, threshold);
+}
+
+// With tolerance >= 0 the loop stops early once the mean absolute change per sample of an
+// iteration drops to the tolerance; iterations is then only a cap. The per-iteration residual
+// goes to residual_log (CSV) if given, otherwise to stdout. With edge_kernel set, row bands are
+// updated with the edge-centric kernel; with fixed_point set, every sample goes through the
+// integer kernel graph_fixed_sample instead. sigma is the width of the Gaussian intensity weight
+// (20 in every other kernel). Returns the iterations performed.
+int graph_diffusion_rgb(PPMImage *input, PPMImage *output, float alpha, float sigma, int iterations,
+                        float tolerance, FILE *residual_log, int edge_kernel, int fixed_point)
+{
+    int width = input->width, height = input->height;
+    float threshold = 20.0f;
+    long long samples = (long long)(width - 2) * (height - 2) * 3;
+
+    int weight_table[256];
+    int alpha_q = graph_fixed_alpha(alpha);
+    graph_fixed_weight_table(weight_table, sigma);
+
+    // Both buffers start from the input so the (never updated) border rows/columns are valid
+    unsigned char *temp = (unsigned char *)malloc(width * height * 3);
+    memcpy(temp, input->data, width * height * 3);
+    memcpy(output->data, input->data, width * height * 3);
+
+    long long changed = 0;
+    double l1 = 0.0;
+    int track = tolerance >= 0.0f; // --tolerance or --residual-csv
+    int done = 0, performed = 0;
+
+    if (residual_log)
+        fprintf(residual_log, "iteration,changed,l1,residual\n");
+
+    // Row bands of the edge-centric kernel; each band recomputes one row of vertical edges
+    int band_rows = 32;
+    int bands = (height - 2 + band_rows - 1) / band_rows;
+
+    #pragma omp parallel
+    {
+        GraphEdgeRow edges = graph_edge_row_alloc(edge_kernel ? width : 0);
+
+        for (int iter = 0; iter < iterations && !done; iter++)
+        {
+            // The residual (and its reduction) is only computed when a tolerance asks for it
+            if (edge_kernel && track)
+            {
+                #pragma omp for schedule(static) reduction(+ : changed, l1)
+                for (int band = 0; band < bands; band++)
+                {
+                    int y0 = 1 + band * band_rows;
+                    int y1 = (y0 + band_rows < height - 1) ? y0 + band_rows : height - 1;
+                    graph_diffusion_rows_edge(temp, output->data, width * 3, 1, width - 1, y0, y1,
+                                              alpha, sigma, threshold, &edges, &changed, &l1);
+                }
+            }
+            else if (edge_kernel)
+            {
+                #pragma omp for schedule(static)
+                for (int band = 0; band < bands; band++)
+                {
+                    int y0 = 1 + band * band_rows;
+                    int y1 = (y0 + band_rows < height - 1) ? y0 + band_rows : height - 1;
+                    graph_diffusion_rows_edge(temp, output->data, width * 3, 1, width - 1, y0, y1,
+                                              alpha, sigma, threshold, &edges, NULL, NULL);
+                }
+            }
+            else if (track)
+            {
+                #pragma omp for collapse(3) reduction(+ : changed, l1)
+                for (int y = 1; y < height - 1; y++)
+                {
+                    for (int x = 1; x < width - 1; x++)
+                    {
+                        for (int c = 0; c < 3; c++)
+                        {
+                            int idx = (y * width + x) * 3 + c;
+                            unsigned char value = graph_pixel_sample(temp, idx, width * 3, alpha, sigma, threshold,
+                                                                     fixed_point, weight_table, alpha_q);
+                            int delta = abs(value - temp[idx]);
+                            changed += (delta != 0);
+                            l1 += delta;
+                            output->data[idx] = value;
+                        }
+                    }
+                }
+            }
+            else
+            {
+                #pragma omp for collapse(3)
+                for (int y = 1; y < height - 1; y++)
+                {
+                    for (int x = 1; x < width - 1; x++)
+                    {
+                        for (int c = 0; c < 3; c++)
+                        {
+                            int idx = (y * width + x) * 3 + c;
+                            output->data[idx] = graph_pixel_sample(temp, idx, width * 3, alpha, sigma, threshold,
+                                                                   fixed_point, weight_table, alpha_q);
+                        }
+                    }
+                }
+            }
+
+            #pragma omp single
+            {
+                unsigned char *swap = temp;
+                temp = output->data;
+                output->data = swap;
+                performed = iter + 1;
+
+                if (track)
+                {
+                    double residual = (samples > 0) ? l1 / samples : 0.0;
+                    if (residual_log)
+                        fprintf(residual_log, "%d,%lld,%.0f,%.6f\n", performed, changed, l1, residual);
+                    else
+                        printf("Iteration %d: %lld samples changed, residual %.6f\n", performed, changed, residual);
+                    if (residual <= tolerance)
+                        done = 1;
+                }
+                changed = 0;
+                l1 = 0.0;
+            }
+        }
+
+        graph_edge_row_free(&edges);
+    }
+
+    // After the last swap temp holds the newest state
+    unsigned char *stale = output->data;
+    output->data = temp;
+    free(stale);
+    return performed;
+}
+
+// Storage precision of the diffusion state between iterations
+enum
+{
+    STATE_U8,
+    STATE_FP16,
+    STATE_FP32
+};
+
+static inline __attribute__((always_inline)) float state_load(const void *buf, int idx, int precision)
+{
+    if (precision == STATE_FP16)
+        return (float)((const _Float16 *)buf)[idx];
+    return ((const float *)buf)[idx];
+}
+
+static inline __attribute__((always_inline)) void state_store(void *buf, int idx, float value, int precision)
+{
+    if (precision == STATE_FP16)
+        ((_Float16 *)buf)[idx] = (_Float16)value;
+    else
+        ((float *)buf)[idx] = value;
+}
+
+// One diffusion step on a float state, the same update as graph_update_sample without the
+// rounding to uint8. Always inlined with a constant precision, so the loads and stores are
+// specialised for fp16 or fp32. The samples whose value changed and their L1 change are
+// added to *changed and *l1.
+static inline __attribute__((always_inline)) void graph_state_step(const void *src, void *dst, int width, int height,
+                                                                   int precision, float alpha, float sigma,
+                                                                   float threshold, long long *changed, double *l1)
+{
+    long long local_changed = 0;
+    double local_l1 = 0.0;
+
+    #pragma omp for nowait
+    for (int y = 1; y < height - 1; y++)
+    {
+        for (int x = 1; x < width - 1; x++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                int idx = (y * width + x) * 3 + c;
+                float center = state_load(src, idx, precision);
+                float neighbors[4] = {
+                    state_load(src, idx - width * 3, precision),
+                    state_load(src, idx + width * 3, precision),
+                    state_load(src, idx - 3, precision),
+                    state_load(src, idx + 3, precision)};
+
+                float weight_sum = 0.0f, weighted_value = 0.0f;
+                for (int i = 0; i < 4; i++)
+                {
+                    float weight = graph_edge_weight(neighbors[i] - center, sigma);
+                    weight_sum += weight;
+                    weighted_value += weight * neighbors[i];
+                }
+
+                float smooth_value = weighted_value / weight_sum;
+                float diff = fabsf(smooth_value - center);
+
+                float result = (diff > threshold) ? smooth_value : center + alpha * (smooth_value - center);
+                result = fminf(fmaxf(result, 0), 255);
+                state_store(dst, idx, result, precision);
+
+                float delta = fabsf(state_load(dst, idx, precision) - center);
+                local_changed += (delta != 0.0f);
+                local_l1 += delta;
+            }
+        }
+    }
+
+    #pragma omp atomic
+    *changed += local_changed;
+    #pragma omp atomic
+    *l1 += local_l1;
+    #pragma omp barrier
+}
+
+static void graph_state_step_fp16(const void *src, void *dst, int width, int height, float alpha, float sigma,
+                                  float threshold, long long *changed, double *l1)
+{
+    graph_state_step(src, dst, width, height, STATE_FP16, alpha, sigma, threshold, changed, l1);
+}
+
+static void graph_state_step_fp32(const void *src, void *dst, int width, int height, float alpha, float sigma,
+                                  float threshold, long long *changed, double *l1)
+{
+    graph_state_step(src, dst, width, height, STATE_FP32, alpha, sigma, threshold, changed, l1);
+}
+
+// Graph diffusion that keeps the state in fp16 or fp32 between iterations and quantises to
+// uint8 only once at the end. The uint8 loop rounds every update back to an integer, so small
+// steps (alpha * difference < 1) vanish and the diffusion stalls; here they accumulate.
+// fp16 needs 2 bytes per sample, fp32 4. tolerance and residual_log work as in
+// graph_diffusion_rgb, with the residual measured on the unquantised state.
+int graph_diffusion_rgb_state(PPMImage *input, PPMImage *output, float alpha, int iterations,
+                              float tolerance, FILE *residual_log, int precision)
+{
+    int width = input->width, height = input->height;
+    float sigma = 20.0f, threshold = 20.0f;
+    long long samples = (long long)(width - 2) * (height - 2) * 3;
+    size_t bytes = (size_t)width * height * 3 * (precision == STATE_FP16 ? sizeof(_Float16) : sizeof(float));
+
+    void *curr = malloc(bytes);
+    void *next = malloc(bytes);
+
+    long long changed = 0;
+    double l1 = 0.0;
+    int done = 0, performed = 0;
+
+    if (residual_log)
+        fprintf(residual_log, "iteration,changed,l1,residual\n");
+
+    #pragma omp parallel
+    {
+        // Both buffers start from the input so the (never updated) border is valid
+        #pragma omp for
+        for (int i = 0; i < width * height * 3; i++)
+        {
+            state_store(curr, i, input->data[i], precision);
+            state_store(next, i, input->data[i], precision);
+        }
+
+        for (int iter = 0; iter < iterations && !done; iter++)
+        {
+            if (precision == STATE_FP16)
+                graph_state_step_fp16(curr, next, width, height, alpha, sigma, threshold, &changed, &l1);
+            else
+                graph_state_step_fp32(curr, next, width, height, alpha, sigma, threshold, &changed, &l1);
+
+        #pragma omp single
+            {
+                void *swap = curr;
+                curr = next;
+                next = swap;
+                performed = iter + 1;
+
+                if (tolerance >= 0.0f)
+                {
+                    double residual = (samples > 0) ? l1 / samples : 0.0;
+                    if (residual_log)
+                        fprintf(residual_log, "%d,%lld,%.3f,%.6f\n", performed, changed, l1, residual);
+                    else
+                        printf("Iteration %d: %lld samples changed, residual %.6f\n", performed, changed, residual);
+                    if (residual <= tolerance)
+                        done = 1;
+                }
+                changed = 0;
+                l1 = 0.0;
+            }
+        }
+
+        // The single quantisation to uint8
+        #pragma omp for
+        for (int i = 0; i < width * height * 3; i++)
+            output->data[i] = (unsigned char)(state_load(curr, i, precision) + 0.5f);
+    }
+
+    free(curr);
+    free(next);
+    return performed;
+}
+
+// One ping-pong step of the graph kernel on samples of any type. Always inlined with a
+// constant type, so graph_sample_step_u8/_u16/_f32 below are separate kernels with the loads,
+// stores and weight lookups specialised. Integer samples take their weights from weight_lut,
+// indexed by the absolute difference (maxval + 1 entries); float samples compute them. Weights,
+// threshold and clamping are scaled by maxval / 255, so sigma and the threshold keep their
+// 8-bit meaning, and the u8 kernel reproduces graph_update_sample bit for bit.
+static inline __attribute__((always_inline)) void graph_sample_step(const void *src, void *dst, int width, int height,
+                                                                    int type, const float *weight_lut, float scale,
+                                                                    float alpha, float sigma, float threshold,
+                                                                    float maxval)
+{
+    #pragma omp for
+    for (int y = 1; y < height - 1; y++)
+    {
+        for (int x = 1; x < width - 1; x++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                size_t idx = ((size_t)y * width + x) * 3 + c;
+                float center = sample_load(src, idx, type);
+                float neighbors[4] = {
+                    sample_load(src, idx - (size_t)width * 3, type),
+                    sample_load(src, idx + (size_t)width * 3, type),
+                    sample_load(src, idx - 3, type),
+                    sample_load(src, idx + 3, type)};
+
+                float weight_sum = 0.0f, weighted_value = 0.0f;
+                for (int i = 0; i < 4; i++)
+                {
+                    float weight = type == SAMPLE_F32 ? graph_edge_weight((neighbors[i] - center) * scale, sigma)
+                                                      : weight_lut[abs((int)neighbors[i] - (int)center)];
+                    weight_sum += weight;
+                    weighted_value += weight * neighbors[i];
+                }
+
+                float smooth_value = weighted_value / weight_sum;
+                float diff = fabsf(smooth_value - center);
+
+                float result = (diff > threshold) ? smooth_value : center + alpha * (smooth_value - center);
+                sample_store(dst, idx, fminf(fmaxf(result, 0), maxval), type);
+            }
+        }
+    }
+}
+
+static void graph_sample_step_u8(const void *src, void *dst, int width, int height, const float *weight_lut,
+                                 float scale, float alpha, float sigma, float threshold, float maxval)
+{
+    graph_sample_step(src, dst, width, height, SAMPLE_U8, weight_lut, scale, alpha, sigma, threshold, maxval);
+}
+
+static void graph_sample_step_u16(const void *src, void *dst, int width, int height, const float *weight_lut,
+                                  float scale, float alpha, float sigma, float threshold, float maxval)
+{
+    graph_sample_step(src, dst, width, height, SAMPLE_U16, weight_lut, scale, alpha, sigma, threshold, maxval);
+}
+
+static void graph_sample_step_f32(const void *src, void *dst, int width, int height, const float *weight_lut,
+                                  float scale, float alpha, float sigma, float threshold, float maxval)
+{
+    graph_sample_step(src, dst, width, height, SAMPLE_F32, weight_lut, scale, alpha, sigma, threshold, maxval);
+}
+
+// Ping-pong graph diffusion of a DeepImage of any sample type and depth; output must have the
+// same size and type as input.
+void graph_diffusion_deep(DeepImage *input, DeepImage *output, float alpha, int iterations)
+{
+    int width = input->width, height = input->height, type = input->type;
+    float maxval = (float)input->maxval;
+    float scale = 255.0f / maxval;
+    float sigma = 20.0f, threshold = 20.0f / scale;
+    size_t bytes = (size_t)width * height * 3 * sample_size(type);
+
+    // One weight per possible absolute difference of integer samples, in 8-bit units
+    float *weight_lut = NULL;
+    if (type != SAMPLE_F32)
+    {
+        weight_lut = (float *)malloc((input->maxval + 1) * sizeof(float));
+        for (int d = 0; d <= input->maxval; d++)
+            weight_lut[d] = graph_edge_weight(d * scale, sigma);
+    }
+
+    // Both buffers start from the input so the (never updated) border is valid
+    void *curr = output->data;
+    void *next = malloc(bytes);
+    memcpy(curr, input->data, bytes);
+    memcpy(next, input->data, bytes);
+
+    #pragma omp parallel
+    {
+        for (int iter = 0; iter < iterations; iter++)
+        {
+            if (type == SAMPLE_U8)
+                graph_sample_step_u8(curr, next, width, height, weight_lut, scale, alpha, sigma, threshold, maxval);
+            else if (type == SAMPLE_U16)
+                graph_sample_step_u16(curr, next, width, height, weight_lut, scale, alpha, sigma, threshold, maxval);
+            else
+                graph_sample_step_f32(curr, next, width, height, weight_lut, scale, alpha, sigma, threshold, maxval);
+
+            #pragma omp single
+            {
+                void *swap = curr;
+                curr = next;
+                next = swap;
+            }
+        }
+    }
+
+    if (curr != output->data)
+    {
+        memcpy(output->data, curr, bytes);
+        free(curr);
+    }
+    else
+    {
+        free(next);
+    }
+    free(weight_lut);
+}
+
+// Plain ping-pong diffusion of every image in list, in one process. The OpenMP thread pool,
+// the weight table (built once; graph_sample_step_u8 with it is bit-identical to
+// graph_diffusion_rgb) and the ping-pong buffers of each slot live across images. concurrent
+// images are in flight at once, each on its share of the threads, so small frames still keep
+// every core busy and one image's I/O overlaps the others' compute. Returns the number of
+// images that failed.
+int graph_diffusion_batch(const BatchList *list, float alpha, int iterations, int concurrent)
+{
+    float sigma = 20.0f, threshold = 20.0f;
+    float weight_lut[256];
+    for (int d = 0; d < 256; d++)
+        weight_lut[d] = graph_edge_weight(d, sigma);
+
+    int threads = omp_get_max_threads();
+    if (concurrent > threads)
+        concurrent = threads;
+    if (concurrent > list->count)
+        concurrent = list->count;
+    int inner = threads / concurrent;
+    omp_set_max_active_levels(2);
+
+    int next_image = 0, failed = 0;
+    #pragma omp parallel num_threads(concurrent)
+    {
+        // Parallel regions opened by this slot (kernel, PNG and tile I/O) use its share
+        omp_set_num_threads(inner);
+        unsigned char *buffers[2] = {NULL, NULL};
+        size_t capacity = 0;
+        for (;;)
+        {
+            int k;
+            #pragma omp atomic capture
+            k = next_image++;
+            if (k >= list->count)
+                break;
+
+            PPMImage *input = read_image(list->inputs[k]);
+            if (!input)
+            {
+                fprintf(stderr, "Skipping %s\n", list->inputs[k]);
+                #pragma omp atomic
+                failed++;
+                continue;
+            }
+            int width = input->width, height = input->height;
+            size_t bytes = (size_t)width * height * 3;
+            if (bytes > capacity)
+            {
+                buffers[0] = (unsigned char *)realloc(buffers[0], bytes);
+                buffers[1] = (unsigned char *)realloc(buffers[1], bytes);
+                capacity = bytes;
+            }
+            // Both buffers start from the input so the (never updated) border is valid
+            memcpy(buffers[0], input->data, bytes);
+            memcpy(buffers[1], input->data, bytes);
+            unsigned char *curr = buffers[0], *next = buffers[1];
+
+            #pragma omp parallel
+            {
+                for (int iter = 0; iter < iterations; iter++)
+                {
+                    graph_sample_step_u8(curr, next, width, height, weight_lut, 1.0f, alpha, sigma, threshold, 255.0f);
+                    #pragma omp single
+                    {
+                        unsigned char *swap = curr;
+                        curr = next;
+                        next = swap;
+                    }
+                }
+            }
+
+            PPMImage output = {width, height, curr};
+            if (write_image(list->outputs[k], &output) != 0)
+            {
+                #pragma omp atomic
+                failed++;
+            }
+            free(input->data);
+            free(input);
+        }
+        free(buffers[0]);
+        free(buffers[1]);
+    }
+    return failed;
+}
+
+// State of the plain ping-pong kernel run by uring_batch_run
+typedef struct
+{
+    float weight_lut[256];
+    float alpha, sigma, threshold;
+    int iterations;
+    unsigned char *scratch;
+    size_t capacity;
+} GraphBatchFilter;
+
+static void graph_batch_filter(unsigned char *pixels, int width, int height, void *context)
+{
+    GraphBatchFilter *filter = (GraphBatchFilter *)context;
+    size_t bytes = (size_t)width * height * 3;
+    if (bytes > filter->capacity)
+    {
+        filter->scratch = (unsigned char *)realloc(filter->scratch, bytes);
+        filter->capacity = bytes;
+    }
+    // The pool buffer itself is one of the ping-pong buffers
+    memcpy(filter->scratch, pixels, bytes);
+    unsigned char *curr = pixels, *next = filter->scratch;
+
+    #pragma omp parallel
+    {
+        for (int iter = 0; iter < filter->iterations; iter++)
+        {
+            graph_sample_step_u8(curr, next, width, height, filter->weight_lut, 1.0f, filter->alpha, filter->sigma,
+                                 filter->threshold, 255.0f);
+            #pragma omp single
+            {
+                unsigned char *swap = curr;
+                curr = next;
+                next = swap;
+            }
+        }
+    }
+    if (curr != pixels)
+        memcpy(pixels, curr, bytes);
+}
+
+// graph_diffusion_batch with io_uring reads and writes of depth images ahead and behind
+int graph_diffusion_batch_uring(const BatchList *list, float alpha, int iterations, int depth)
+{
+    GraphBatchFilter filter;
+    filter.alpha = alpha;
+    filter.sigma = 20.0f;
+    filter.threshold = 20.0f;
+    filter.iterations = iterations;
+    filter.scratch = NULL;
+    filter.capacity = 0;
+    for (int d = 0; d < 256; d++)
+        filter.weight_lut[d] = graph_edge_weight(d, filter.sigma);
+    int failed = uring_batch_run(list, depth, graph_batch_filter, &filter);
+    free(filter.scratch);
+    return failed;
+}
+
+// Temporally blocked graph diffusion (overlapped tiling).
+// Each tile is loaded together with a halo of time_block pixels into a private buffer and
+// advanced time_block iterations there; the valid region shrinks by one pixel per step, so
+// after the block only the tile itself is written back. The full image is streamed through
+// memory once per time block instead of once per iteration. Every sample goes through
+// graph_update_sample on exactly the same inputs as in graph_diffusion_rgb, so the result is
+// bit-identical to the ping-pong loop.
+void graph_diffusion_rgb_tiled(PPMImage *input, PPMImage *output, float alpha, int iterations,
+                               int tile_size, int time_block, int edge_kernel)
+{
+    int width = input->width, height = input->height;
+    float sigma = 20.0f, threshold = 20.0f;
+
+    unsigned char *curr = (unsigned char *)malloc(width * height * 3);
+    memcpy(curr, input->data, width * height * 3);
+    memcpy(output->data, input->data, width * height * 3);
+    unsigned char *next = output->data;
+
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int buf_dim = tile_size + 2 * time_block;
+
+    #pragma omp parallel
+    {
+        unsigned char *buf_a = (unsigned char *)malloc(buf_dim * buf_dim * 3);
+        unsigned char *buf_b = (unsigned char *)malloc(buf_dim * buf_dim * 3);
+        GraphEdgeRow edges = graph_edge_row_alloc(edge_kernel ? buf_dim : 0);
+        long long changed = 0; // unused, required by graph_diffusion_rows_edge
+        double l1 = 0.0;
+
+        for (int iter = 0; iter < iterations; iter += time_block)
+        {
+            int steps = (iterations - iter < time_block) ? iterations - iter : time_block;
+
+            #pragma omp for collapse(2) schedule(dynamic)
+            for (int ty = 0; ty < tiles_y; ty++)
+            {
+                for (int tx = 0; tx < tiles_x; tx++)
+                {
+                    int x0 = tx * tile_size, x1 = (x0 + tile_size < width) ? x0 + tile_size : width;
+                    int y0 = ty * tile_size, y1 = (y0 + tile_size < height) ? y0 + tile_size : height;
+
+                    // Tile plus halo, clamped to the image
+                    int hx0 = (x0 - steps < 0) ? 0 : x0 - steps;
+                    int hy0 = (y0 - steps < 0) ? 0 : y0 - steps;
+                    int hx1 = (x1 + steps > width) ? width : x1 + steps;
+                    int hy1 = (y1 + steps > height) ? height : y1 + steps;
+                    int bw = hx1 - hx0;
+                    int stride = bw * 3;
+
+                    for (int y = hy0; y < hy1; y++)
+                    {
+                        memcpy(buf_a + (y - hy0) * stride, curr + (y * width + hx0) * 3, stride);
+                    }
+                    memcpy(buf_b, buf_a, (hy1 - hy0) * stride);
+
+                    unsigned char *src = buf_a, *dst = buf_b;
+                    for (int s = 1; s <= steps; s++)
+                    {
+                        // Region still valid after s steps, restricted to the image interior
+                        int ux0 = x0 - (steps - s), ux1 = x1 + (steps - s);
+                        int uy0 = y0 - (steps - s), uy1 = y1 + (steps - s);
+                        if (ux0 < 1) ux0 = 1;
+                        if (uy0 < 1) uy0 = 1;
+                        if (ux1 > width - 1) ux1 = width - 1;
+                        if (uy1 > height - 1) uy1 = height - 1;
+
+                        if (edge_kernel && ux0 < ux1 && uy0 < uy1)
+                        {
+                            graph_diffusion_rows_edge(src, dst, stride, ux0 - hx0, ux1 - hx0, uy0 - hy0, uy1 - hy0,
+                                                      alpha, sigma, threshold, &edges, &changed, &l1);
+                        }
+                        else
+                        {
+                            for (int y = uy0; y < uy1; y++)
+                            {
+                                for (int x = ux0; x < ux1; x++)
+                                {
+                                    for (int c = 0; c < 3; c++)
+                                    {
+                                        int idx = (y - hy0) * stride + (x - hx0) * 3 + c;
+                                        dst[idx] = graph_update_sample(src, idx, stride, alpha, sigma, threshold);
+                                    }
+                                }
+                            }
+                        }
+                        unsigned char *swap = src;
+                        src = dst;
+                        dst = swap;
+                    }
+
+                    for (int y = y0; y < y1; y++)
+                    {
+                        memcpy(next + (y * width + x0) * 3, src + (y - hy0) * stride + (x0 - hx0) * 3, (x1 - x0) * 3);
+                    }
+                }
+            }
+
+        #pragma omp single
+            {
+                unsigned char *swap = curr;
+                curr = next;
+                next = swap;
+            }
+        }
+
+        free(buf_a);
+        free(buf_b);
+        graph_edge_row_free(&edges);
+    }
+
+    // curr holds the newest state
+    output->data = curr;
+    free(next);
+}
+
+// Sparse active-set graph diffusion.
+// Once the uint8 state is quantised most pixels stop changing. Tiles are tracked in a bitmap
+// of tiles that changed in the last iteration; a tile is recomputed only if it or one of its
+// four neighbour tiles changed, since only then can its 4-neighbourhood differ from the
+// previous step. A skipped tile did not change in the previous iteration either, so the
+// buffer written two steps ago already holds its current value and it is carried forward
+// without a copy. The result is bit-identical to graph_diffusion_rgb. The number of tile
+// updates performed and the number a full sweep would need go to *updates and *total.
+void graph_diffusion_rgb_active(PPMImage *input, PPMImage *output, float alpha, int iterations, int tile_size,
+                                long long *updates, long long *total)
+{
+    int width = input->width, height = input->height;
+    float sigma = 20.0f, threshold = 20.0f;
+
+    unsigned char *temp = (unsigned char *)malloc(width * height * 3);
+    memcpy(temp, input->data, width * height * 3);
+    memcpy(output->data, input->data, width * height * 3);
+
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int tile_count = tiles_x * tiles_y;
+    int words = (tile_count + 63) / 64;
+
+    // changed[t] bit set = tile t changed in the last iteration
+    unsigned long long *changed = (unsigned long long *)malloc(words * sizeof(unsigned long long));
+    unsigned long long *changed_next = (unsigned long long *)calloc(words, sizeof(unsigned long long));
+    memset(changed, 0xff, words * sizeof(unsigned long long)); // everything is active at first
+    int *active = (int *)malloc(tile_count * sizeof(int));
+    int active_count = 0;
+    long long tile_updates = 0;
+
+    #pragma omp parallel
+    {
+        for (int iter = 0; iter < iterations; iter++)
+        {
+        #pragma omp single
+            {
+                active_count = 0;
+                for (int t = 0; t < tile_count; t++)
+                {
+                    int tx = t % tiles_x, ty = t / tiles_x;
+                    int dirty = (changed[t >> 6] >> (t & 63)) & 1;
+                    if (!dirty && tx > 0)
+                        dirty = (changed[(t - 1) >> 6] >> ((t - 1) & 63)) & 1;
+                    if (!dirty && tx < tiles_x - 1)
+                        dirty = (changed[(t + 1) >> 6] >> ((t + 1) & 63)) & 1;
+                    if (!dirty && ty > 0)
+                        dirty = (changed[(t - tiles_x) >> 6] >> ((t - tiles_x) & 63)) & 1;
+                    if (!dirty && ty < tiles_y - 1)
+                        dirty = (changed[(t + tiles_x) >> 6] >> ((t + tiles_x) & 63)) & 1;
+                    if (dirty)
+                        active[active_count++] = t;
+                }
+                tile_updates += active_count;
+            }
+
+            #pragma omp for schedule(dynamic)
+            for (int a = 0; a < active_count; a++)
+            {
+                int t = active[a];
+                int x0 = (t % tiles_x) * tile_size, y0 = (t / tiles_x) * tile_size;
+                int x1 = (x0 + tile_size < width - 1) ? x0 + tile_size : width - 1;
+                int y1 = (y0 + tile_size < height - 1) ? y0 + tile_size : height - 1;
+                if (x0 < 1) x0 = 1;
+                if (y0 < 1) y0 = 1;
+
+                int tile_changed = 0;
+                for (int y = y0; y < y1; y++)
+                {
+                    for (int x = x0; x < x1; x++)
+                    {
+                        for (int c = 0; c < 3; c++)
+                        {
+                            int idx = (y * width + x) * 3 + c;
+                            unsigned char value = graph_update_sample(temp, idx, width * 3, alpha, sigma, threshold);
+                            tile_changed |= (value != temp[idx]);
+                            output->data[idx] = value;
+                        }
+                    }
+                }
+                if (tile_changed)
+                {
+                    #pragma omp atomic
+                    changed_next[t >> 6] |= 1ULL << (t & 63);
+                }
+            }
+
+        #pragma omp single
+            {
+                unsigned char *swap = temp;
+                temp = output->data;
+                output->data = swap;
+
+                unsigned long long *swap_bits = changed;
+                changed = changed_next;
+                changed_next = swap_bits;
+                memset(changed_next, 0, words * sizeof(unsigned long long));
+            }
+        }
+    }
+
+    *updates = tile_updates;
+    *total = (long long)tile_count * iterations;
+
+    // After the last swap temp holds the newest state
+    unsigned char *stale = output->data;
+    output->data = temp;
+    free(stale);
+    free(changed);
+    free(changed_next);
+    free(active);
+}
+
+// One group of rows of the out-of-core engine: output rows [first_row, last_row) are computed
+// from input rows [in_start, in_end), the group plus a halo of one row per iteration
 typedef struct
 {
-    int width;
-    int height;
-    unsigned char *data; // RGB data stored as [R, G, B, R, G, B, ...]
-} PPMImage;
+    int first_row, last_row;
+    int in_start, in_end;
+    unsigned char *a, *b; // ping-pong buffers of the input rows
+    unsigned char *result;
+} DiffusionGroup;
+
+// Advance the rows of group steps iterations in memory. Rows at the buffer edge are never
+// updated, so stale halo values only reach one row further per step and the group rows are
+// exact after steps iterations (the same argument as graph_diffusion_rgb_tiled).
+static void diffusion_group_advance(DiffusionGroup *group, int width, int steps, float alpha, float sigma,
+                                    float threshold)
+{
+    int rows = group->in_end - group->in_start;
+    size_t row_bytes = (size_t)width * 3;
+    unsigned char *curr = group->a, *next = group->b;
+    memcpy(next, curr, rows * row_bytes);
+
+    #pragma omp parallel
+    {
+        for (int s = 0; s < steps; s++)
+        {
+            #pragma omp for collapse(2)
+            for (int y = 1; y < rows - 1; y++)
+                for (int x = 1; x < width - 1; x++)
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int idx = (y * width + x) * 3 + c;
+                        next[idx] = graph_update_sample(curr, idx, width * 3, alpha, sigma, threshold);
+                    }
 
-// Read PPM (P6 format)
-PPMImage *read_ppm(const char *filename)
+        #pragma omp single
+            {
+                unsigned char *swap = curr;
+                curr = next;
+                next = swap;
+            }
+        }
+    }
+    group->result = curr;
+}
+
+// Out-of-core graph diffusion for images larger than memory. The image stays on disk: each
+// pass streams it from a source (the input file, then one half of a scratch file) to a
+// destination (the other half, or the output file for the last pass) in groups of full-width
+// rows. Every group is loaded with a halo of time_block rows and advanced time_block
+// iterations in memory, so one trip through the disk covers time_block iterations. Groups
+// are sized so that three of them (being read, computed and written) fit in memory_bytes;
+// while one is computed by the thread team, two more threads prefetch the next group and
+// write back the previous one. The output is bit-identical to graph_diffusion_rgb.
+// Returns 0 on success.
+int graph_diffusion_rgb_out_of_core(const char *input_file, const char *output_file, const char *scratch_file,
+                                    float alpha, int iterations, int time_block, size_t memory_bytes)
 {
-    FILE *fp = fopen(filename, "rb");
+    float sigma = 20.0f, threshold = 20.0f;
+
+    FILE *fp = fopen(input_file, "rb");
     if (!fp)
     {
         perror("Error opening file");
-        return NULL;
+        return -1;
     }
-
-    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
     char version[3];
-    if (fscanf(fp, "%2s", version) != 1)
+    int width, height;
+    if (fscanf(fp, "%2s", version) != 1 || version[1] != '6' || fscanf(fp, "%d %d %*d", &width, &height) != 2)
     {
-        fprintf(stderr, "Error reading PPM version\n");
+        fprintf(stderr, "Only P6 supported\n");
         fclose(fp);
-        free(img);
-        return NULL;
+        return -1;
     }
-    if (version[1] != '6')
+    fgetc(fp); // Skip newline
+    off_t input_offset = ftell(fp);
+    fclose(fp);
+
+    char header[64];
+    int header_length = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    size_t row_bytes = (size_t)width * 3, image_bytes = row_bytes * height;
+
+    int in_fd = open(input_file, O_RDONLY);
+    int out_fd = open(output_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int scratch_fd = (iterations > time_block) ? open(scratch_file, O_RDWR | O_CREAT | O_TRUNC, 0600) : -1;
+    if (in_fd < 0 || out_fd < 0 || (iterations > time_block && scratch_fd < 0))
     {
-        fprintf(stderr, "Only P6 supported\n");
-        fclose(fp);
-        free(img);
-        return NULL;
+        perror("Error opening out-of-core files");
+        if (in_fd >= 0)
+            close(in_fd);
+        if (out_fd >= 0)
+            close(out_fd);
+        if (scratch_fd >= 0)
+            close(scratch_fd);
+        return -1;
+    }
+    if (scratch_fd >= 0)
+        unlink(scratch_file); // removed automatically once closed
+    int status = pwrite_full(out_fd, header, header_length, 0);
+
+    // Three groups of two buffers, each group_rows rows plus the halo on both sides
+    long group_rows = (long)(memory_bytes / (6 * row_bytes)) - 2 * time_block;
+    if (group_rows < 1)
+        group_rows = 1;
+    if (group_rows > height)
+        group_rows = height;
+    size_t buffer_bytes = (group_rows + 2 * (size_t)time_block) * row_bytes;
+    printf("Out-of-core: groups of %ld rows, %.1f MB resident.\n", group_rows, 6.0 * buffer_bytes / (1 << 20));
+
+    DiffusionGroup groups[3];
+    for (int g = 0; g < 3; g++)
+    {
+        groups[g].a = (unsigned char *)malloc(buffer_bytes);
+        groups[g].b = (unsigned char *)malloc(buffer_bytes);
+    }
+    int count = (height + group_rows - 1) / group_rows;
+
+    omp_set_max_active_levels(2);
+    for (int iter = 0; iter < iterations && status == 0; iter += time_block)
+    {
+        int steps = (iterations - iter < time_block) ? iterations - iter : time_block;
+        int pass = iter / time_block, last = (iter + steps >= iterations);
+        int src_fd = (pass == 0) ? in_fd : scratch_fd;
+        off_t src_offset = (pass == 0) ? input_offset : (off_t)(((pass - 1) % 2) * image_bytes);
+        int dst_fd = last ? out_fd : scratch_fd;
+        off_t dst_offset = last ? (off_t)header_length : (off_t)((pass % 2) * image_bytes);
+
+        int read_error = 0, write_error = 0;
+        for (int k = -1; k <= count; k++)
+        {
+            DiffusionGroup *reading = &groups[(k + 4) % 3];
+            DiffusionGroup *computing = &groups[(k + 3) % 3];
+            DiffusionGroup *writing = &groups[(k + 2) % 3];
+
+            #pragma omp parallel sections num_threads(3)
+            {
+                #pragma omp section
+                {
+                    // Prefetch group k + 1
+                    if (k + 1 < count)
+                    {
+                        reading->first_row = (k + 1) * group_rows;
+                        reading->last_row = (reading->first_row + group_rows < height) ? reading->first_row + group_rows : height;
+                        reading->in_start = (reading->first_row > steps) ? reading->first_row - steps : 0;
+                        reading->in_end = (reading->last_row + steps < height) ? reading->last_row + steps : height;
+                        if (pread_full(src_fd, reading->a, (reading->in_end - reading->in_start) * row_bytes,
+                                       src_offset + (off_t)reading->in_start * row_bytes) != 0)
+                            read_error = 1;
+                    }
+                }
+                #pragma omp section
+                {
+                    // Write back group k - 1
+                    if (k - 1 >= 0)
+                    {
+                        const unsigned char *rows = writing->result + (writing->first_row - writing->in_start) * row_bytes;
+                        if (pwrite_full(dst_fd, rows, (writing->last_row - writing->first_row) * row_bytes,
+                                        dst_offset + (off_t)writing->first_row * row_bytes) != 0)
+                            write_error = 1;
+                    }
+                }
+                #pragma omp section
+                {
+                    if (k >= 0 && k < count)
+                        diffusion_group_advance(computing, width, steps, alpha, sigma, threshold);
+                }
+            }
+            if (read_error || write_error)
+            {
+                fprintf(stderr, "Error %s out-of-core image data\n", read_error ? "reading" : "writing");
+                status = -1;
+                break;
+            }
+        }
+    }
+
+    for (int g = 0; g < 3; g++)
+    {
+        free(groups[g].a);
+        free(groups[g].b);
+    }
+    close(in_fd);
+    if (close(out_fd) != 0)
+        status = -1;
+    if (scratch_fd >= 0)
+        close(scratch_fd);
+    return status;
+}
+
+// Neighbourhood stencils as (dx, dy) offsets. STENCIL_4 is the graph of graph_diffusion_rgb;
+// the disks hold every offset with 0 < dx^2 + dy^2 <= r^2.
+static const int stencil_8_offsets[8][2] = {
+    {0, -1}, {0, 1}, {-1, 0}, {1, 0}, {-1, -1}, {1, -1}, {-1, 1}, {1, 1}};
+static const int stencil_disk2_offsets[12][2] = {
+    {0, -1}, {0, 1}, {-1, 0}, {1, 0}, {-1, -1}, {1, -1}, {-1, 1}, {1, 1},
+    {0, -2}, {0, 2}, {-2, 0}, {2, 0}};
+static const int stencil_disk3_offsets[28][2] = {
+    {0, -1}, {0, 1}, {-1, 0}, {1, 0}, {-1, -1}, {1, -1}, {-1, 1}, {1, 1},
+    {0, -2}, {0, 2}, {-2, 0}, {2, 0}, {-1, -2}, {1, -2}, {-2, -1}, {2, -1},
+    {-2, 1}, {2, 1}, {-1, 2}, {1, 2}, {-2, -2}, {2, -2}, {-2, 2}, {2, 2},
+    {0, -3}, {0, 3}, {-3, 0}, {3, 0}};
+
+enum
+{
+    STENCIL_4,
+    STENCIL_8,
+    STENCIL_DISK2,
+    STENCIL_DISK3
+};
+
+// One diffusion step with an n-point stencil. offsets are byte offsets of the neighbours and
+// spatial their distance weights. Always inlined into the fixed-size wrappers below, so n is a
+// compile-time constant there and the neighbour loops are fully unrolled.
+static inline __attribute__((always_inline)) void graph_stencil_step(const unsigned char *src, unsigned char *dst,
+                                                                     int width, int height, int radius, int n,
+                                                                     const int *offsets, const float *spatial,
+                                                                     float alpha, float sigma, float threshold)
+{
+    #pragma omp for
+    for (int y = radius; y < height - radius; y++)
+    {
+        for (int x = radius; x < width - radius; x++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                int idx = (y * width + x) * 3 + c;
+                int center = src[idx];
+
+                float weight_sum = 0.0f, weighted_value = 0.0f;
+                for (int i = 0; i < n; i++)
+                {
+                    int neighbor = src[idx + offsets[i]];
+                    float weight = spatial[i] * graph_edge_weight(neighbor - center, sigma);
+                    weight_sum += weight;
+                    weighted_value += weight * neighbor;
+                }
+
+                float smooth_value = weighted_value / weight_sum;
+                float diff = fabsf(smooth_value - center);
+
+                float result = (diff > threshold) ? smooth_value : center + alpha * (smooth_value - center);
+                dst[idx] = (unsigned char)(fminf(fmaxf(result, 0), 255));
+            }
+        }
+    }
+}
+
+static void graph_stencil_step_8(const unsigned char *src, unsigned char *dst, int width, int height,
+                                 const int *offsets, const float *spatial, float alpha, float sigma, float threshold)
+{
+    graph_stencil_step(src, dst, width, height, 1, 8, offsets, spatial, alpha, sigma, threshold);
+}
+
+static void graph_stencil_step_12(const unsigned char *src, unsigned char *dst, int width, int height,
+                                  const int *offsets, const float *spatial, float alpha, float sigma, float threshold)
+{
+    graph_stencil_step(src, dst, width, height, 2, 12, offsets, spatial, alpha, sigma, threshold);
+}
+
+static void graph_stencil_step_28(const unsigned char *src, unsigned char *dst, int width, int height,
+                                  const int *offsets, const float *spatial, float alpha, float sigma, float threshold)
+{
+    graph_stencil_step(src, dst, width, height, 3, 28, offsets, spatial, alpha, sigma, threshold);
+}
+
+// Graph diffusion on a wider neighbourhood (8-connected or a radius-2/3 disk). Every offset
+// gets a precomputed spatial weight exp(-d^2 / (2 spatial_sigma^2)) that multiplies the usual
+// intensity weight, so farther neighbours count less. A wider stencil reaches the same amount of
+// smoothing in far fewer iterations, i.e. fewer passes over memory. Pixels closer than the
+// stencil radius to the border are left as in the input.
+void graph_diffusion_rgb_stencil(PPMImage *input, PPMImage *output, float alpha, int iterations,
+                                 int stencil, float spatial_sigma)
+{
+    int width = input->width, height = input->height;
+    float sigma = 20.0f, threshold = 20.0f;
+
+    const int (*table)[2] = (stencil == STENCIL_8) ? stencil_8_offsets
+                            : (stencil == STENCIL_DISK2) ? stencil_disk2_offsets
+                                                         : stencil_disk3_offsets;
+    int n = (stencil == STENCIL_8) ? 8 : (stencil == STENCIL_DISK2) ? 12 : 28;
+
+    int offsets[28];
+    float spatial[28];
+    for (int i = 0; i < n; i++)
+    {
+        int dx = table[i][0], dy = table[i][1];
+        offsets[i] = (dy * width + dx) * 3;
+        spatial[i] = expf(-(float)(dx * dx + dy * dy) / (2 * spatial_sigma * spatial_sigma));
+    }
+
+    unsigned char *temp = (unsigned char *)malloc(width * height * 3);
+    memcpy(temp, input->data, width * height * 3);
+    memcpy(output->data, input->data, width * height * 3);
+
+    #pragma omp parallel
+    {
+        for (int iter = 0; iter < iterations; iter++)
+        {
+            if (n == 8)
+                graph_stencil_step_8(temp, output->data, width, height, offsets, spatial, alpha, sigma, threshold);
+            else if (n == 12)
+                graph_stencil_step_12(temp, output->data, width, height, offsets, spatial, alpha, sigma, threshold);
+            else
+                graph_stencil_step_28(temp, output->data, width, height, offsets, spatial, alpha, sigma, threshold);
+
+        #pragma omp single
+            {
+                unsigned char *swap = temp;
+                temp = output->data;
+                output->data = swap;
+            }
+        }
+    }
+
+    // After the last swap temp holds the newest state
+    unsigned char *stale = output->data;
+    output->data = temp;
+    free(stale);
+}
+
+// Edge weight metrics of graph_diffusion_rgb_joint
+enum
+{
+    WEIGHTS_CHANNEL, // separate weight per channel (graph_diffusion_rgb)
+    WEIGHTS_RGB_L2,  // one weight per neighbour from the Euclidean RGB distance
+    WEIGHTS_RGB_L1   // one weight per neighbour from the L1 RGB distance
+};
+
+// Graph diffusion with joint-colour edge weights. Each neighbour gets a single weight from its
+// RGB distance to the centre pixel, shared by all three channels, so the channels diffuse across
+// the same edges and colours do not bleed. The distance is divided by the channel count so a
+// grey step weighs the same as in the per-channel kernel: exp(-(|d|^2 / 3) / (2 sigma^2)) for L2,
+// exp(-(|d|_1 / 3)^2 / (2 sigma^2)) for L1. The weights come from a table indexed by the squared
+// L2 distance (0..3 * 255^2) or the L1 distance (0..3 * 255): four lookups per pixel instead of
+// twelve expf, and each pixel is read as one contiguous RGB triple.
+void graph_diffusion_rgb_joint(PPMImage *input, PPMImage *output, float alpha, int iterations, int metric)
+{
+    int width = input->width, height = input->height;
+    float sigma = 20.0f, threshold = 20.0f;
+
+    int table_size = (metric == WEIGHTS_RGB_L2) ? 3 * 255 * 255 + 1 : 3 * 255 + 1;
+    float *weight_table = (float *)malloc(table_size * sizeof(float));
+    for (int d = 0; d < table_size; d++)
+    {
+        float distance = (metric == WEIGHTS_RGB_L2) ? sqrtf(d / 3.0f) : d / 3.0f;
+        weight_table[d] = graph_edge_weight(distance, sigma);
+    }
+
+    unsigned char *temp = (unsigned char *)malloc(width * height * 3);
+    memcpy(temp, input->data, width * height * 3);
+    memcpy(output->data, input->data, width * height * 3);
+
+    #pragma omp parallel
+    {
+        for (int iter = 0; iter < iterations; iter++)
+        {
+            #pragma omp for collapse(2)
+            for (int y = 1; y < height - 1; y++)
+            {
+                for (int x = 1; x < width - 1; x++)
+                {
+                    int idx = (y * width + x) * 3;
+                    const unsigned char *center = temp + idx;
+                    const unsigned char *neighbor_pixels[4] = {
+                        temp + idx - width * 3,
+                        temp + idx + width * 3,
+                        temp + idx - 3,
+                        temp + idx + 3};
+
+                    float weights[4];
+                    for (int i = 0; i < 4; i++)
+                    {
+                        int dr = neighbor_pixels[i][0] - center[0];
+                        int dg = neighbor_pixels[i][1] - center[1];
+                        int db = neighbor_pixels[i][2] - center[2];
+                        int d = (metric == WEIGHTS_RGB_L2) ? dr * dr + dg * dg + db * db : abs(dr) + abs(dg) + abs(db);
+                        weights[i] = weight_table[d];
+                    }
+
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int neighbors[4] = {
+                            neighbor_pixels[0][c],
+                            neighbor_pixels[1][c],
+                            neighbor_pixels[2][c],
+                            neighbor_pixels[3][c]};
+                        output->data[idx + c] = graph_combine_sample(center[c], neighbors, weights, alpha, threshold);
+                    }
+                }
+            }
+
+        #pragma omp single
+            {
+                unsigned char *swap = temp;
+                temp = output->data;
+                output->data = swap;
+            }
+        }
+    }
+
+    // After the last swap temp holds the newest state
+    unsigned char *stale = output->data;
+    output->data = temp;
+    free(stale);
+    free(weight_table);
+}
+
+// Ping-pong graph diffusion of an interleaved plane with channels samples per pixel, in place.
+// The same update as graph_diffusion_rgb, which it matches for channels == 3.
+void graph_diffusion_plane(unsigned char *data, int width, int height, int channels, float alpha, int iterations)
+{
+    float sigma = 20.0f, threshold = 20.0f;
+    int size = width * height * channels, row_stride = width * channels;
+
+    unsigned char *curr = data;
+    unsigned char *next = (unsigned char *)malloc(size);
+    memcpy(next, data, size);
+
+    #pragma omp parallel
+    {
+        for (int iter = 0; iter < iterations; iter++)
+        {
+            #pragma omp for collapse(2)
+            for (int y = 1; y < height - 1; y++)
+            {
+                for (int x = 1; x < width - 1; x++)
+                {
+                    for (int c = 0; c < channels; c++)
+                    {
+                        int idx = (y * width + x) * channels + c;
+                        int center = curr[idx];
+                        int neighbors[4] = {
+                            curr[idx - row_stride],
+                            curr[idx + row_stride],
+                            curr[idx - channels],
+                            curr[idx + channels]};
+                        float weights[4];
+                        for (int i = 0; i < 4; i++)
+                            weights[i] = graph_edge_weight(neighbors[i] - center, sigma);
+                        next[idx] = graph_combine_sample(center, neighbors, weights, alpha, threshold);
+                    }
+                }
+            }
+
+        #pragma omp single
+            {
+                unsigned char *swap = curr;
+                curr = next;
+                next = swap;
+            }
+        }
+    }
+
+    if (curr != data)
+    {
+        memcpy(data, curr, size);
+        free(curr);
     }
+    else
+        free(next);
+}
+
+// Graph diffusion in YCbCr: luma at full resolution, chroma at 2x2 subsampling, so about half
+// the samples of graph_diffusion_rgb are updated per iteration
+void graph_diffusion_rgb_ycbcr(PPMImage *input, PPMImage *output, float alpha, int iterations)
+{
+    YCbCrImage *ycc = rgb_to_ycbcr420(input);
+    graph_diffusion_plane(ycc->luma, ycc->width, ycc->height, 1, alpha, iterations);
+    graph_diffusion_plane(ycc->chroma, ycc->chroma_width, ycc->chroma_height, 2, alpha, iterations);
+    ycbcr420_to_rgb(ycc, output);
+    free_ycbcr(ycc);
+}
+
+// One parameter setting of a sweep
+typedef struct
+{
+    float alpha;
+    float sigma;
+} SweepSetting;
 
-    if (fscanf(fp, "%d %d %*d", &img->width, &img->height) != 2)
+// Read "alpha sigma" pairs, one per line; empty lines and lines starting with '#' are skipped.
+// Returns the number of settings (*settings is malloc'ed) or -1 on error.
+int read_sweep_settings(const char *filename, SweepSetting **settings)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
     {
-        fprintf(stderr, "Error reading image dimensions\n");
-        fclose(fp);
-        free(img);
-        return NULL;
+        perror("Error opening sweep file");
+        return -1;
     }
-    fgetc(fp); // Skip newline
 
-    img->data = (unsigned char *)malloc(img->width * img->height * 3);
-    if (fread(img->data, 1, img->width * img->height * 3, fp) != img->width * img->height * 3)
+    int count = 0, capacity = 16;
+    *settings = (SweepSetting *)malloc(capacity * sizeof(SweepSetting));
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), fp))
     {
-        fprintf(stderr, "Error reading image data\n");
-        fclose(fp);
-        free(img->data);
-        free(img);
-        return NULL;
+        line_number++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '#' || *p == '\n' || *p == '\0')
+            continue;
+
+        SweepSetting setting;
+        if (sscanf(p, "%f %f", &setting.alpha, &setting.sigma) != 2 || setting.sigma <= 0.0f)
+        {
+            fprintf(stderr, "%s:%d: expected \"alpha sigma\" with sigma > 0\n", filename, line_number);
+            fclose(fp);
+            free(*settings);
+            return -1;
+        }
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *settings = (SweepSetting *)realloc(*settings, capacity * sizeof(SweepSetting));
+        }
+        (*settings)[count++] = setting;
     }
     fclose(fp);
-    return img;
+    return count;
 }
 
-// Write PPM (P6 format)
-void write_ppm(const char *filename, PPMImage *img)
+// Output file of sweep setting k: "_<k>" inserted before the extension of output
+void sweep_output_name(const char *output, int k, char *name, size_t size)
 {
-    FILE *fp = fopen(filename, "wb");
-    fprintf(fp, "P6\n%d %d\n255\n", img->width, img->height);
-    fwrite(img->data, 1, img->width * img->height * 3, fp);
-    fclose(fp);
+    const char *slash = strrchr(output, '/');
+    const char *dot = strrchr(output, '.');
+    if (!dot || (slash && dot < slash))
+        dot = output + strlen(output);
+    snprintf(name, size, "%.*s_%d%s", (int)(dot - output), output, k, dot);
 }
 
-// Enhanced edge-aware graph diffusion - Parallelized with OpenMP
-void graph_diffusion_rgb(PPMImage *input, PPMImage *output, float alpha, int iterations)
+// Graph diffusion for count parameter settings at once. The states are interleaved sample by
+// sample (state[i * count + k]), so the neighbour loads of all settings come from the same cache
+// lines, and they are advanced tile by tile with the temporal blocking of
+// graph_diffusion_rgb_tiled: each tile_size tile plus a halo of time_block pixels is copied into
+// a thread-local buffer holding every setting and advanced time_block iterations there, so the
+// image is streamed through memory once per time block for all settings together. The
+// intensity weights are looked up in a per-setting table of the 256 possible differences,
+// holding exactly the values graph_edge_weight would return, so setting k is bit-identical to
+// a ping-pong run with its alpha and sigma. outputs[k] receives the result of setting k.
+void graph_diffusion_rgb_sweep(PPMImage *input, unsigned char **outputs, const SweepSetting *settings,
+                               int count, int iterations, int tile_size, int time_block)
 {
-    unsigned char *temp = (unsigned char *)malloc(input->width * input->height * 3);
-    memcpy(temp, input->data, input->width * input->height * 3);
-
     int width = input->width, height = input->height;
-    float sigma = 20.0f, threshold = 20.0f;
+    float threshold = 20.0f;
+    size_t samples = (size_t)width * height * 3;
+
+    float *weight_tables = (float *)malloc((size_t)count * 256 * sizeof(float));
+    for (int k = 0; k < count; k++)
+        for (int d = 0; d < 256; d++)
+            weight_tables[k * 256 + d] = graph_edge_weight((float)d, settings[k].sigma);
+
+    unsigned char *curr = (unsigned char *)malloc(samples * count);
+    unsigned char *next = (unsigned char *)malloc(samples * count);
+    size_t pixel_bytes = 3 * (size_t)count;
+
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    size_t buf_dim = tile_size + 2 * (size_t)time_block;
 
     #pragma omp parallel
     {
-        for (int iter = 0; iter < iterations; iter++)
+        // Both buffers start from the input so the (never updated) border is valid
+        #pragma omp for
+        for (size_t i = 0; i < samples; i++)
         {
-            #pragma omp for collapse(3)
-            for (int y = 1; y < height - 1; y++)
+            for (int k = 0; k < count; k++)
             {
-                for (int x = 1; x < width - 1; x++)
+                curr[i * count + k] = input->data[i];
+                next[i * count + k] = input->data[i];
+            }
+        }
+
+        unsigned char *buf_a = (unsigned char *)malloc(buf_dim * buf_dim * pixel_bytes);
+        unsigned char *buf_b = (unsigned char *)malloc(buf_dim * buf_dim * pixel_bytes);
+
+        for (int iter = 0; iter < iterations; iter += time_block)
+        {
+            int steps = (iterations - iter < time_block) ? iterations - iter : time_block;
+
+            #pragma omp for collapse(2) schedule(dynamic)
+            for (int ty = 0; ty < tiles_y; ty++)
+            {
+                for (int tx = 0; tx < tiles_x; tx++)
                 {
-                    for (int c = 0; c < 3; c++)
+                    int x0 = tx * tile_size, x1 = (x0 + tile_size < width) ? x0 + tile_size : width;
+                    int y0 = ty * tile_size, y1 = (y0 + tile_size < height) ? y0 + tile_size : height;
+
+                    // Tile plus halo, clamped to the image
+                    int hx0 = (x0 - steps < 0) ? 0 : x0 - steps;
+                    int hy0 = (y0 - steps < 0) ? 0 : y0 - steps;
+                    int hx1 = (x1 + steps > width) ? width : x1 + steps;
+                    int hy1 = (y1 + steps > height) ? height : y1 + steps;
+                    size_t stride = (hx1 - hx0) * pixel_bytes;
+
+                    for (int y = hy0; y < hy1; y++)
                     {
-                        int idx = (y * width + x) * 3 + c;
-                        int center = temp[idx];
+                        memcpy(buf_a + (y - hy0) * stride, curr + ((size_t)y * width + hx0) * pixel_bytes, stride);
+                    }
+                    memcpy(buf_b, buf_a, (hy1 - hy0) * stride);
 
-                        int neighbors[4] = {
-                            temp[((y - 1) * width + x) * 3 + c],
-                            temp[((y + 1) * width + x) * 3 + c],
-                            temp[(y * width + (x - 1)) * 3 + c],
-                            temp[(y * width + (x + 1)) * 3 + c]};
+                    unsigned char *src = buf_a, *dst = buf_b;
+                    for (int s = 1; s <= steps; s++)
+                    {
+                        // Region still valid after s steps, restricted to the image interior
+                        int ux0 = x0 - (steps - s), ux1 = x1 + (steps - s);
+                        int uy0 = y0 - (steps - s), uy1 = y1 + (steps - s);
+                        if (ux0 < 1) ux0 = 1;
+                        if (uy0 < 1) uy0 = 1;
+                        if (ux1 > width - 1) ux1 = width - 1;
+                        if (uy1 > height - 1) uy1 = height - 1;
 
-                        float weight_sum = 0.0f, weighted_value = 0.0f;
-                        for (int i = 0; i < 4; i++)
+                        for (int y = uy0; y < uy1; y++)
                         {
-                            float diff = neighbors[i] - center;
-                            float weight = expf(-(diff * diff) / (2 * sigma * sigma));
-                            weight_sum += weight;
-                            weighted_value += weight * neighbors[i];
+                            for (int x = ux0; x < ux1; x++)
+                            {
+                                for (int c = 0; c < 3; c++)
+                                {
+                                    size_t base = (y - hy0) * stride + (x - hx0) * pixel_bytes + c * (size_t)count;
+                                    for (int k = 0; k < count; k++)
+                                    {
+                                        const float *table = weight_tables + k * 256;
+                                        size_t idx = base + k;
+                                        int center = src[idx];
+                                        int neighbors[4] = {
+                                            src[idx - stride],
+                                            src[idx + stride],
+                                            src[idx - pixel_bytes],
+                                            src[idx + pixel_bytes]};
+                                        float weights[4];
+                                        for (int i = 0; i < 4; i++)
+                                            weights[i] = table[abs(neighbors[i] - center)];
+                                        dst[idx] = graph_combine_sample(center, neighbors, weights, settings[k].alpha,
+                                                                        threshold);
+                                    }
+                                }
+                            }
                         }
+                        unsigned char *swap = src;
+                        src = dst;
+                        dst = swap;
+                    }
 
-                        float smooth_value = weighted_value / weight_sum;
-                        float diff = fabsf(smooth_value - center);
-
-                        float result = (diff > threshold) ? smooth_value : center + alpha * (smooth_value - center);
-                        output->data[idx] = (unsigned char)(fminf(fmaxf(result, 0), 255));
+                    for (int y = y0; y < y1; y++)
+                    {
+                        memcpy(next + ((size_t)y * width + x0) * pixel_bytes,
+                               src + (y - hy0) * stride + (x0 - hx0) * pixel_bytes, (x1 - x0) * pixel_bytes);
                     }
                 }
             }
 
         #pragma omp single
             {
-                unsigned char *swap = temp;
-                temp = output->data;
-                output->data = swap;
+                unsigned char *swap = curr;
+                curr = next;
+                next = swap;
+            }
+        }
+
+        free(buf_a);
+        free(buf_b);
+
+        #pragma omp for
+        for (size_t i = 0; i < samples; i++)
+            for (int k = 0; k < count; k++)
+                outputs[k][i] = curr[i * count + k];
+    }
+
+    free(weight_tables);
+    free(curr);
+    free(next);
+}
+
+int compare_u64(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Superpixel region-adjacency-graph diffusion.
+// 1. SLIC: superpixels centres start on a grid with spacing S and are refined by k-means in
+//    (r, g, b, x, y); each pixel only looks at the centres of the 3x3 grid cells around it.
+// 2. Region adjacency graph: one node per superpixel (its mean colour), one edge per pair of
+//    touching superpixels, weighted by the boundary length times the Gaussian edge weight of
+//    the mean colours (graph_edge_weight, as in graph_diffusion_rgb).
+// 3. iterations steps of the alpha diffusion on that graph (thousands of nodes, not millions).
+// 4. Projection: every pixel takes the diffused mean of its region plus its own deviation from
+//    the region mean; deviations beyond the threshold (salt and pepper) are dropped, mirroring
+//    the threshold rule of the pixel filter. Pixels on superpixel boundaries then get one
+//    pixel-level graph update to soften the region borders.
+// The region and edge counts and the grid step go to *region_count, *edge_count and *grid_step.
+void graph_diffusion_rgb_superpixel(PPMImage *input, PPMImage *output, float alpha, int iterations, int superpixels,
+                                    int *region_count, int *edge_count, int *grid_step)
+{
+    int width = input->width, height = input->height;
+    float sigma = 20.0f, threshold = 20.0f;
+    float compactness = 10.0f;
+    int slic_iterations = 5; // SLIC is usually converged after a handful of k-means passes
+    const unsigned char *img = input->data;
+
+    // Grid spacing rounded to nearest, so the number of grid cells (and regions) stays close to
+    // superpixels instead of overshooting it as truncation would
+    int step = (int)(sqrtf((float)width * height / superpixels) + 0.5f);
+    if (step < 1)
+        step = 1;
+    int grid_x = (width + step - 1) / step, grid_y = (height + step - 1) / step;
+    int regions = grid_x * grid_y;
+    float spatial = (compactness / step) * (compactness / step);
+
+    int *labels = (int *)malloc(width * height * sizeof(int));
+    float *centers = (float *)malloc(regions * 5 * sizeof(float)); // r, g, b, x, y
+    double *sums = (double *)calloc(regions * 6, sizeof(double));   // r, g, b, x, y, count
+    int threads = omp_get_max_threads();
+    double *thread_sums = (double *)malloc((size_t)threads * regions * 6 * sizeof(double));
+
+    // Start from the grid cells themselves
+    #pragma omp parallel for
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            labels[y * width + x] = (y / step) * grid_x + x / step;
+
+    for (int it = 0; it <= slic_iterations; it++)
+    {
+        // Update: centre = mean colour and position of its pixels
+        memset(thread_sums, 0, (size_t)threads * regions * 6 * sizeof(double));
+        #pragma omp parallel
+        {
+            double *local = thread_sums + (size_t)omp_get_thread_num() * regions * 6;
+            #pragma omp for
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    int p = y * width + x;
+                    double *acc = local + labels[p] * 6;
+                    acc[0] += img[p * 3 + 0];
+                    acc[1] += img[p * 3 + 1];
+                    acc[2] += img[p * 3 + 2];
+                    acc[3] += x;
+                    acc[4] += y;
+                    acc[5] += 1.0;
+                }
+            }
+        }
+        #pragma omp parallel for
+        for (int k = 0; k < regions; k++)
+        {
+            for (int j = 0; j < 6; j++)
+            {
+                double total = 0.0;
+                for (int t = 0; t < threads; t++)
+                    total += thread_sums[((size_t)t * regions + k) * 6 + j];
+                sums[k * 6 + j] = total;
+            }
+            double count = sums[k * 6 + 5];
+            for (int j = 0; j < 5; j++)
+                centers[k * 5 + j] = (count > 0) ? (float)(sums[k * 6 + j] / count) : -1e9f; // empty: unreachable
+        }
+        if (it == slic_iterations)
+            break;
+
+        // Assignment: nearest centre among the 3x3 neighbouring grid cells
+        #pragma omp parallel for
+        for (int y = 0; y < height; y++)
+        {
+            int gy = y / step;
+            for (int x = 0; x < width; x++)
+            {
+                int p = y * width + x, gx = x / step;
+                float best = 1e30f;
+                for (int cy = gy - 1; cy <= gy + 1; cy++)
+                {
+                    for (int cx = gx - 1; cx <= gx + 1; cx++)
+                    {
+                        if (cx < 0 || cy < 0 || cx >= grid_x || cy >= grid_y)
+                            continue;
+                        int k = cy * grid_x + cx;
+                        const float *ctr = centers + k * 5;
+                        float dr = img[p * 3 + 0] - ctr[0], dg = img[p * 3 + 1] - ctr[1], db = img[p * 3 + 2] - ctr[2];
+                        float dx = x - ctr[3], dy = y - ctr[4];
+                        float d = dr * dr + dg * dg + db * db + spatial * (dx * dx + dy * dy);
+                        if (d < best)
+                        {
+                            best = d;
+                            labels[p] = k;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Region adjacency: collect (a, b) label pairs across right/down pixel edges, then sort and
+    // count duplicates so that each edge carries its boundary length
+    unsigned long long **pair_lists = (unsigned long long **)calloc(threads, sizeof(unsigned long long *));
+    long long *pair_counts = (long long *)calloc(threads, sizeof(long long));
+    #pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        long long capacity = 1024, count = 0;
+        unsigned long long *list = (unsigned long long *)malloc(capacity * sizeof(unsigned long long));
+        #pragma omp for
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                int a = labels[y * width + x];
+                int nb[2] = {(x < width - 1) ? labels[y * width + x + 1] : a,
+                             (y < height - 1) ? labels[(y + 1) * width + x] : a};
+                for (int j = 0; j < 2; j++)
+                {
+                    if (nb[j] == a)
+                        continue;
+                    if (count == capacity)
+                    {
+                        capacity *= 2;
+                        list = (unsigned long long *)realloc(list, capacity * sizeof(unsigned long long));
+                    }
+                    int lo = (a < nb[j]) ? a : nb[j], hi = (a < nb[j]) ? nb[j] : a;
+                    list[count++] = ((unsigned long long)lo << 32) | (unsigned int)hi;
+                }
+            }
+        }
+        pair_lists[tid] = list;
+        pair_counts[tid] = count;
+    }
+    long long total_pairs = 0;
+    for (int t = 0; t < threads; t++)
+        total_pairs += pair_counts[t];
+    unsigned long long *pairs = (unsigned long long *)malloc((total_pairs + 1) * sizeof(unsigned long long));
+    long long offset = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        memcpy(pairs + offset, pair_lists[t], pair_counts[t] * sizeof(unsigned long long));
+        offset += pair_counts[t];
+        free(pair_lists[t]);
+    }
+    qsort(pairs, total_pairs, sizeof(unsigned long long), compare_u64);
+
+    // Symmetric CSR adjacency with the boundary length of every edge
+    int edges = 0;
+    int *degree = (int *)calloc(regions + 1, sizeof(int));
+    for (long long i = 0; i < total_pairs; i++)
+    {
+        if (i > 0 && pairs[i] == pairs[i - 1])
+            continue;
+        degree[pairs[i] >> 32]++;
+        degree[pairs[i] & 0xffffffffu]++;
+        edges++;
+    }
+    int *adj_start = (int *)malloc((regions + 1) * sizeof(int));
+    adj_start[0] = 0;
+    for (int k = 0; k < regions; k++)
+        adj_start[k + 1] = adj_start[k] + degree[k];
+    int *adj = (int *)malloc(2 * edges * sizeof(int));
+    float *boundary = (float *)malloc(2 * edges * sizeof(float));
+    memset(degree, 0, (regions + 1) * sizeof(int));
+    for (long long i = 0; i < total_pairs;)
+    {
+        long long j = i;
+        while (j < total_pairs && pairs[j] == pairs[i])
+            j++;
+        int a = (int)(pairs[i] >> 32), b = (int)(pairs[i] & 0xffffffffu);
+        int ka = adj_start[a] + degree[a]++, kb = adj_start[b] + degree[b]++;
+        adj[ka] = b;
+        adj[kb] = a;
+        boundary[ka] = boundary[kb] = (float)(j - i);
+        i = j;
+    }
+    *region_count = regions;
+    *edge_count = edges;
+    *grid_step = step;
+
+    // Diffusion on the region graph
+    float *mean = (float *)malloc(regions * 3 * sizeof(float));
+    float *mean_next = (float *)malloc(regions * 3 * sizeof(float));
+    float *mean_orig = (float *)malloc(regions * 3 * sizeof(float));
+    for (int k = 0; k < regions; k++)
+        for (int c = 0; c < 3; c++)
+            mean[k * 3 + c] = mean_orig[k * 3 + c] = centers[k * 5 + c];
+
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        #pragma omp parallel for schedule(dynamic, 64)
+        for (int k = 0; k < regions; k++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                float center = mean[k * 3 + c];
+                float weight_sum = 0.0f, weighted_value = 0.0f;
+                for (int e = adj_start[k]; e < adj_start[k + 1]; e++)
+                {
+                    float neighbor = mean[adj[e] * 3 + c];
+                    float weight = boundary[e] * graph_edge_weight(neighbor - center, sigma);
+                    weight_sum += weight;
+                    weighted_value += weight * neighbor;
+                }
+                mean_next[k * 3 + c] = (weight_sum > 0.0f)
+                                           ? center + alpha * (weighted_value / weight_sum - center)
+                                           : center;
             }
         }
+        float *swap = mean;
+        mean = mean_next;
+        mean_next = swap;
     }
 
-    if (iterations % 2 == 1)
+    // Projection back to pixels
+    unsigned char *projected = (unsigned char *)malloc(width * height * 3);
+    #pragma omp parallel for
+    for (int p = 0; p < width * height; p++)
     {
-        memcpy(output->data, temp, width * height * 3);
+        int k = labels[p];
+        for (int c = 0; c < 3; c++)
+        {
+            float detail = img[p * 3 + c] - mean_orig[k * 3 + c];
+            if (fabsf(detail) > threshold)
+                detail = 0.0f;
+            float result = mean[k * 3 + c] + detail;
+            projected[p * 3 + c] = (unsigned char)(fminf(fmaxf(result, 0), 255));
+        }
+    }
+
+    // Light pixel-level refinement on superpixel boundaries
+    memcpy(output->data, projected, width * height * 3);
+    #pragma omp parallel for
+    for (int y = 1; y < height - 1; y++)
+    {
+        for (int x = 1; x < width - 1; x++)
+        {
+            int p = y * width + x, k = labels[p];
+            if (labels[p - 1] == k && labels[p + 1] == k && labels[p - width] == k && labels[p + width] == k)
+                continue;
+            for (int c = 0; c < 3; c++)
+                output->data[p * 3 + c] = graph_update_sample(projected, p * 3 + c, width * 3, alpha, sigma, threshold);
+        }
     }
 
-    free(temp);
+    free(labels);
+    free(centers);
+    free(sums);
+    free(thread_sums);
+    free(pair_lists);
+    free(pair_counts);
+    free(pairs);
+    free(degree);
+    free(adj_start);
+    free(adj);
+    free(boundary);
+    free(mean);
+    free(mean_next);
+    free(mean_orig);
+    free(projected);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 5)
+    if (argc < 5)
     {
-        printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations>\n", argv[0]);
+        printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations> [--schedule=pingpong|tiled|active] [--tile=N] [--time-block=N] [--kernel=pixel|edge]"
+               " [--tolerance=X] [--max-iterations=N] [--residual-csv=file]"
+               " [--graph=pixel|superpixel] [--superpixels=N]"
+               " [--stencil=4|8|disk2|disk3] [--spatial-sigma=X]"
+               " [--state=u8|fp16|fp32] [--fixed-point] [--sweep=file] [--sigma=X]"
+               " [--weights=channel|rgb-l2|rgb-l1] [--colorspace=rgb|ycbcr] [--mmap]"
+               " [--out-of-core] [--memory=MB] [--scratch=file] [--samples=u8|u16|float]"
+               " [--batch] [--concurrent=N] [--io=stdio|uring] [--io-depth=N]\n"
+               "       %s <dir|glob|manifest> <output_dir> <alpha> <iterations> --batch [--concurrent=N]"
+               " [--io=stdio|uring] [--io-depth=N]\n",
+               argv[0], argv[0]);
         return 1;
     }
 
@@ -150,6 +2027,273 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    // Optional flags
+    enum { SCHEDULE_PINGPONG, SCHEDULE_TILED, SCHEDULE_ACTIVE } schedule = SCHEDULE_PINGPONG;
+    int tile_size = 0;    // 0: default of the chosen schedule
+    int time_block = 8;
+    int edge_kernel = 0;
+    float tolerance = -1.0f; // < 0: run the fixed number of iterations
+    const char *residual_csv = NULL;
+    int superpixel_graph = 0;
+    int superpixels = 4096;
+    int stencil = STENCIL_4;
+    float spatial_sigma = 1.0f;
+    int precision = STATE_U8;
+    int fixed_point = 0;
+    const char *sweep_file = NULL;
+    float sigma = 20.0f;
+    int weight_metric = WEIGHTS_CHANNEL;
+    int ycbcr = 0;
+    int use_mmap = 0;
+    int out_of_core = 0;
+    long memory_mb = 256;
+    const char *scratch_file = NULL;
+    int sample_type = -1; // < 0: 8-bit path unless the input is deeper
+    int batch = 0;
+    int concurrent = 1;
+    int io_uring = 0;
+    int io_depth = 4;
+    for (int i = 5; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--schedule=pingpong") == 0)
+            schedule = SCHEDULE_PINGPONG;
+        else if (strcmp(argv[i], "--schedule=tiled") == 0)
+            schedule = SCHEDULE_TILED;
+        else if (strcmp(argv[i], "--schedule=active") == 0)
+            schedule = SCHEDULE_ACTIVE;
+        else if (strcmp(argv[i], "--kernel=pixel") == 0)
+            edge_kernel = 0;
+        else if (strcmp(argv[i], "--kernel=edge") == 0)
+            edge_kernel = 1;
+        else if (strcmp(argv[i], "--graph=pixel") == 0)
+            superpixel_graph = 0;
+        else if (strcmp(argv[i], "--graph=superpixel") == 0)
+            superpixel_graph = 1;
+        else if (strncmp(argv[i], "--superpixels=", 14) == 0)
+            superpixels = atoi(argv[i] + 14);
+        else if (strcmp(argv[i], "--stencil=4") == 0)
+            stencil = STENCIL_4;
+        else if (strcmp(argv[i], "--stencil=8") == 0)
+            stencil = STENCIL_8;
+        else if (strcmp(argv[i], "--stencil=disk2") == 0)
+            stencil = STENCIL_DISK2;
+        else if (strcmp(argv[i], "--stencil=disk3") == 0)
+            stencil = STENCIL_DISK3;
+        else if (strcmp(argv[i], "--batch") == 0)
+            batch = 1;
+        else if (strncmp(argv[i], "--concurrent=", 13) == 0)
+            concurrent = atoi(argv[i] + 13);
+        else if (strcmp(argv[i], "--io=stdio") == 0)
+            io_uring = 0;
+        else if (strcmp(argv[i], "--io=uring") == 0)
+            io_uring = 1;
+        else if (strncmp(argv[i], "--io-depth=", 11) == 0)
+            io_depth = atoi(argv[i] + 11);
+        else if (strcmp(argv[i], "--samples=u8") == 0)
+            sample_type = SAMPLE_U8;
+        else if (strcmp(argv[i], "--samples=u16") == 0)
+            sample_type = SAMPLE_U16;
+        else if (strcmp(argv[i], "--samples=float") == 0)
+            sample_type = SAMPLE_F32;
+        else if (strcmp(argv[i], "--out-of-core") == 0)
+            out_of_core = 1;
+        else if (strncmp(argv[i], "--memory=", 9) == 0)
+            memory_mb = atol(argv[i] + 9);
+        else if (strncmp(argv[i], "--scratch=", 10) == 0)
+            scratch_file = argv[i] + 10;
+        else if (strcmp(argv[i], "--mmap") == 0)
+            use_mmap = 1;
+        else if (strcmp(argv[i], "--colorspace=rgb") == 0)
+            ycbcr = 0;
+        else if (strcmp(argv[i], "--colorspace=ycbcr") == 0)
+            ycbcr = 1;
+        else if (strcmp(argv[i], "--weights=channel") == 0)
+            weight_metric = WEIGHTS_CHANNEL;
+        else if (strcmp(argv[i], "--weights=rgb-l2") == 0)
+            weight_metric = WEIGHTS_RGB_L2;
+        else if (strcmp(argv[i], "--weights=rgb-l1") == 0)
+            weight_metric = WEIGHTS_RGB_L1;
+        else if (strncmp(argv[i], "--sweep=", 8) == 0)
+            sweep_file = argv[i] + 8;
+        else if (strncmp(argv[i], "--sigma=", 8) == 0)
+            sigma = atof(argv[i] + 8);
+        else if (strcmp(argv[i], "--fixed-point") == 0)
+            fixed_point = 1;
+        else if (strcmp(argv[i], "--state=u8") == 0)
+            precision = STATE_U8;
+        else if (strcmp(argv[i], "--state=fp16") == 0)
+            precision = STATE_FP16;
+        else if (strcmp(argv[i], "--state=fp32") == 0)
+            precision = STATE_FP32;
+        else if (strncmp(argv[i], "--spatial-sigma=", 16) == 0)
+            spatial_sigma = atof(argv[i] + 16);
+        else if (strncmp(argv[i], "--tile=", 7) == 0)
+            tile_size = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--time-block=", 13) == 0)
+            time_block = atoi(argv[i] + 13);
+        else if (strncmp(argv[i], "--tolerance=", 12) == 0)
+            tolerance = atof(argv[i] + 12);
+        else if (strncmp(argv[i], "--max-iterations=", 17) == 0)
+            iterations = atoi(argv[i] + 17);
+        else if (strncmp(argv[i], "--residual-csv=", 15) == 0)
+            residual_csv = argv[i] + 15;
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (tile_size == 0)
+    {
+        // Temporal tiles (+ halo) should stay well inside L2; sweep tiles hold every setting, so
+        // they are smaller; active-set tiles are kept small so that the few pixels still
+        // changing do not drag whole large tiles along
+        tile_size = sweep_file ? 64 : (schedule == SCHEDULE_TILED) ? 128 : 32;
+    }
+    if (tile_size <= 0 || time_block <= 0)
+    {
+        fprintf(stderr, "Tile size and time block must be positive integers.\n");
+        return 1;
+    }
+    if (iterations <= 0)
+    {
+        fprintf(stderr, "Iterations must be a positive integer.\n");
+        return 1;
+    }
+    if (schedule != SCHEDULE_PINGPONG && (tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "Convergence mode is only supported with --schedule=pingpong.\n");
+        return 1;
+    }
+    if (schedule == SCHEDULE_ACTIVE && edge_kernel)
+    {
+        fprintf(stderr, "The edge kernel is not supported with --schedule=active.\n");
+        return 1;
+    }
+    if (superpixel_graph && (schedule != SCHEDULE_PINGPONG || edge_kernel || tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "--graph=superpixel has its own schedule and cannot be combined with other modes.\n");
+        return 1;
+    }
+    if (stencil != STENCIL_4 && (superpixel_graph || schedule != SCHEDULE_PINGPONG || edge_kernel ||
+                                 tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "Wider stencils only support the plain ping-pong schedule.\n");
+        return 1;
+    }
+    if (precision != STATE_U8 && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG ||
+                                  edge_kernel))
+    {
+        fprintf(stderr, "--state=fp16|fp32 is only supported with the pixel kernel and --schedule=pingpong.\n");
+        return 1;
+    }
+    if (fixed_point && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG || edge_kernel ||
+                        precision != STATE_U8))
+    {
+        fprintf(stderr, "--fixed-point is only supported with the pixel kernel and --schedule=pingpong.\n");
+        return 1;
+    }
+    if (sweep_file && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG || edge_kernel ||
+                       precision != STATE_U8 || fixed_point || tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "--sweep runs the plain ping-pong kernel and cannot be combined with other modes.\n");
+        return 1;
+    }
+    if (weight_metric != WEIGHTS_CHANNEL && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG ||
+                                             edge_kernel || precision != STATE_U8 || fixed_point || sweep_file ||
+                                             tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "Joint-colour weights only support the plain ping-pong schedule.\n");
+        return 1;
+    }
+    if (ycbcr && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG || edge_kernel ||
+                  precision != STATE_U8 || fixed_point || sweep_file || weight_metric != WEIGHTS_CHANNEL ||
+                  tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "--colorspace=ycbcr only supports the plain ping-pong schedule.\n");
+        return 1;
+    }
+    if (out_of_core && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG || edge_kernel ||
+                        precision != STATE_U8 || fixed_point || sweep_file || weight_metric != WEIGHTS_CHANNEL ||
+                        ycbcr || use_mmap || tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "--out-of-core only supports the plain pixel kernel.\n");
+        return 1;
+    }
+    if ((use_mmap || out_of_core) && (is_png_file(argv[1]) || is_png_file(argv[2])))
+    {
+        fprintf(stderr, "--mmap and --out-of-core need PPM input and output files.\n");
+        return 1;
+    }
+    // PPM input with more than 8 bits per sample, or an explicit --samples, goes through the
+    // sample-generic kernel
+    int deep = sample_type >= 0 || (!batch && !is_png_file(argv[1]) && !has_extension(argv[1], ".tim") &&
+                                     ppm_maxval(argv[1]) > 255);
+    if (batch && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG || edge_kernel ||
+                  precision != STATE_U8 || fixed_point || sweep_file || weight_metric != WEIGHTS_CHANNEL || ycbcr ||
+                  use_mmap || out_of_core || deep || tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "--batch runs the plain ping-pong kernel and cannot be combined with other modes.\n");
+        return 1;
+    }
+    if (concurrent <= 0)
+    {
+        fprintf(stderr, "The number of concurrent images must be a positive integer.\n");
+        return 1;
+    }
+    if (io_uring && (!batch || concurrent > 1))
+    {
+        fprintf(stderr, "--io=uring applies to --batch runs with one image in flight at a time.\n");
+        return 1;
+    }
+    if (io_depth <= 0)
+    {
+        fprintf(stderr, "The I/O depth must be a positive integer.\n");
+        return 1;
+    }
+    if (deep && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG || edge_kernel ||
+                 precision != STATE_U8 || fixed_point || sweep_file || weight_metric != WEIGHTS_CHANNEL || ycbcr ||
+                 use_mmap || out_of_core || tolerance >= 0.0f || residual_csv))
+    {
+        fprintf(stderr, "High-bit-depth input and --samples only support the plain ping-pong kernel.\n");
+        return 1;
+    }
+    if (sigma <= 0.0f)
+    {
+        fprintf(stderr, "Sigma must be positive.\n");
+        return 1;
+    }
+    if (sigma != 20.0f && (superpixel_graph || stencil != STENCIL_4 || schedule != SCHEDULE_PINGPONG ||
+                           precision != STATE_U8 || sweep_file || weight_metric != WEIGHTS_CHANNEL || ycbcr ||
+                           out_of_core || batch || deep))
+    {
+        fprintf(stderr, "--sigma is only supported by the ping-pong schedule with the 8-bit pixel or edge kernel.\n");
+        return 1;
+    }
+    if (deep && (is_png_file(argv[1]) || is_png_file(argv[2]) || has_extension(argv[1], ".tim") ||
+                 has_extension(argv[2], ".tim")))
+    {
+        fprintf(stderr, "High-bit-depth input and --samples need PPM input and output files.\n");
+        return 1;
+    }
+    if (memory_mb <= 0)
+    {
+        fprintf(stderr, "The memory budget must be a positive number of MB.\n");
+        return 1;
+    }
+    if (spatial_sigma <= 0.0f)
+    {
+        fprintf(stderr, "The spatial sigma must be positive.\n");
+        return 1;
+    }
+    if (superpixels <= 0)
+    {
+        fprintf(stderr, "The number of superpixels must be a positive integer.\n");
+        return 1;
+    }
+    if (residual_csv && tolerance < 0.0f)
+        tolerance = 0.0f; // log the residual, stop only at a fixed point
+
     // Set number of threads for OpenMP (optional, often defaults to max available)
     int omp_threads = omp_get_max_threads();
     printf("Using %d OpenMP threads.\n", omp_threads);
@@ -157,7 +2301,97 @@ int main(int argc, char *argv[])
 
     double total_start_time = omp_get_wtime();
 
-    PPMImage *input = read_ppm(argv[1]);
+    if (batch)
+    {
+        BatchList list;
+        int count = collect_batch(argv[1], argv[2], &list);
+        if (count <= 0)
+        {
+            if (count == 0)
+                fprintf(stderr, "No images found in %s.\n", argv[1]);
+            return 1;
+        }
+        int failed;
+        if (io_uring)
+        {
+            for (int k = 0; k < list.count; k++)
+            {
+                if (!has_extension(list.inputs[k], ".ppm") || !has_extension(list.outputs[k], ".ppm"))
+                {
+                    fprintf(stderr, "--io=uring needs PPM input and output files: %s\n", list.inputs[k]);
+                    free_batch(&list);
+                    return 1;
+                }
+            }
+            failed = graph_diffusion_batch_uring(&list, alpha, iterations, io_depth);
+            if (failed < 0)
+            {
+                fprintf(stderr, "io_uring is not available, falling back to --io=stdio.\n");
+                io_uring = 0;
+            }
+        }
+        if (!io_uring)
+            failed = graph_diffusion_batch(&list, alpha, iterations, concurrent);
+        double elapsed = omp_get_wtime() - total_start_time;
+        printf("Batch of %d images (%d failed) completed at %.1f images per second.\n", count, failed,
+               count / elapsed);
+        printf("Total process completed in %.4f seconds.\n", elapsed);
+        free_batch(&list);
+        return failed ? 1 : 0;
+    }
+
+    if (out_of_core)
+    {
+        // The image never resides in memory; reading and writing overlap with the diffusion
+        char scratch_name[4096];
+        if (!scratch_file)
+        {
+            snprintf(scratch_name, sizeof(scratch_name), "%s.scratch", argv[2]);
+            scratch_file = scratch_name;
+        }
+        if (graph_diffusion_rgb_out_of_core(argv[1], argv[2], scratch_file, alpha, iterations, time_block,
+                                            (size_t)memory_mb << 20) != 0)
+            return 1;
+        printf("Total process completed in %.4f seconds.\n", omp_get_wtime() - total_start_time);
+        return 0;
+    }
+
+    if (deep)
+    {
+        DeepImage *file = read_ppm_deep(argv[1]);
+        if (!file)
+            return 1;
+        if (sample_type < 0)
+            sample_type = file->type;
+        if (sample_type == SAMPLE_U8 && file->maxval > 255)
+        {
+            fprintf(stderr, "--samples=u8 cannot hold maxval %d.\n", file->maxval);
+            return 1;
+        }
+        printf("Diffusing %d-bit samples as %s.\n", file->maxval > 255 ? 16 : 8,
+               sample_type == SAMPLE_U8 ? "u8" : sample_type == SAMPLE_U16 ? "u16" : "float");
+        DeepImage *input = convert_samples(file, sample_type);
+        DeepImage *output = convert_samples(file, sample_type);
+
+        double start_time = omp_get_wtime();
+        graph_diffusion_deep(input, output, alpha, iterations);
+        printf("Graph-based denoising completed in %.4f seconds.\n", omp_get_wtime() - start_time);
+
+        // Written back with the depth of the input file
+        DeepImage *result = convert_samples(output, file->type);
+        if (write_ppm_deep(argv[2], result) != 0)
+            return 1;
+        printf("Total process completed in %.4f seconds.\n", omp_get_wtime() - total_start_time);
+
+        free_deep(result);
+        free_deep(output);
+        free_deep(input);
+        free_deep(file);
+        return 0;
+    }
+
+    // With --mmap the input pixels are read straight from the page cache of the file
+    PPMImage *input = use_mmap ? map_ppm(argv[1]) : read_image(argv[1]);
     if (!input)
         return 1;
 
@@ -167,15 +2401,105 @@ int main(int argc, char *argv[])
     output->data = (unsigned char *)malloc(input->width * input->height * 3);
 
     double start_time = omp_get_wtime();
-    graph_diffusion_rgb(input, output, alpha, iterations);
-    printf("Graph-based denoising completed in %.4f seconds.\n", omp_get_wtime() - start_time);
+    if (sweep_file)
+    {
+        // One output per setting, named after <output.ppm>; <alpha> is not used
+        SweepSetting *settings;
+        int count = read_sweep_settings(sweep_file, &settings);
+        if (count <= 0)
+        {
+            if (count == 0)
+                fprintf(stderr, "The sweep file has no settings.\n");
+            return 1;
+        }
+
+        unsigned char **outputs = (unsigned char **)malloc(count * sizeof(unsigned char *));
+        for (int k = 0; k < count; k++)
+            outputs[k] = (unsigned char *)malloc(input->width * input->height * 3);
 
-    write_ppm(argv[2], output);
+        graph_diffusion_rgb_sweep(input, outputs, settings, count, iterations, tile_size, time_block);
+        printf("Graph-based denoising of %d settings completed in %.4f seconds.\n", count,
+               omp_get_wtime() - start_time);
+
+        unsigned char *data = output->data;
+        for (int k = 0; k < count; k++)
+        {
+            char name[4096];
+            sweep_output_name(argv[2], k, name, sizeof(name));
+            output->data = outputs[k];
+            if (store_ppm(name, output, use_mmap) != 0)
+                return 1;
+            printf("Setting %d: alpha %g, sigma %g -> %s\n", k, settings[k].alpha, settings[k].sigma, name);
+            free(outputs[k]);
+        }
+        output->data = data;
+        free(outputs);
+        free(settings);
+    }
+    else if (superpixel_graph)
+    {
+        int regions, edges, step;
+        graph_diffusion_rgb_superpixel(input, output, alpha, iterations, superpixels, &regions, &edges, &step);
+        printf("Superpixel graph: %d regions, %d edges (step %d).\n", regions, edges, step);
+    }
+    else if (ycbcr)
+    {
+        graph_diffusion_rgb_ycbcr(input, output, alpha, iterations);
+    }
+    else if (weight_metric != WEIGHTS_CHANNEL)
+    {
+        graph_diffusion_rgb_joint(input, output, alpha, iterations, weight_metric);
+    }
+    else if (stencil != STENCIL_4)
+    {
+        graph_diffusion_rgb_stencil(input, output, alpha, iterations, stencil, spatial_sigma);
+    }
+    else if (schedule == SCHEDULE_TILED)
+    {
+        graph_diffusion_rgb_tiled(input, output, alpha, iterations, tile_size, time_block, edge_kernel);
+    }
+    else if (schedule == SCHEDULE_ACTIVE)
+    {
+        long long updates, total;
+        graph_diffusion_rgb_active(input, output, alpha, iterations, tile_size, &updates, &total);
+        printf("Active set: %lld of %lld tile updates (%.1f%%).\n", updates, total, 100.0 * updates / total);
+    }
+    else
+    {
+        FILE *residual_log = NULL;
+        if (residual_csv && !(residual_log = fopen(residual_csv, "w")))
+        {
+            perror("Error opening residual CSV");
+            return 1;
+        }
+        int performed = (precision == STATE_U8)
+                            ? graph_diffusion_rgb(input, output, alpha, sigma, iterations, tolerance, residual_log,
+                                                  edge_kernel, fixed_point)
+                            : graph_diffusion_rgb_state(input, output, alpha, iterations, tolerance, residual_log,
+                                                        precision);
+        if (residual_log)
+            fclose(residual_log);
+        if (tolerance >= 0.0f)
+            printf("Stopped after %d of at most %d iterations.\n", performed, iterations);
+    }
+    if (!sweep_file)
+    {
+        printf("Graph-based denoising completed in %.4f seconds.\n", omp_get_wtime() - start_time);
+        if (store_ppm(argv[2], output, use_mmap) != 0)
+            return 1;
+    }
 
     printf("Total process completed in %.4f seconds.\n", omp_get_wtime() - total_start_time);
 
-    free(input->data);
-    free(input);
+    if (use_mmap)
+    {
+        unmap_ppm(input);
+    }
+    else
+    {
+        free(input->data);
+        free(input);
+    }
     free(output->data);
     free(output);
 
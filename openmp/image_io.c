@@ -0,0 +1,1650 @@
+// Image input and output for the OpenMP programs; see image_io.h.
+#define _DEFAULT_SOURCE // pread, pwrite, madvise, MADV_* and ftruncate under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <png.h>
+#include <zlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <glob.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <omp.h>
+#include "image_io.h"
+
+// Read PPM (P6 format)
+PPMImage *read_ppm(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        perror("Error opening file");
+        return NULL;
+    }
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    char version[3];
+    if (fscanf(fp, "%2s", version) != 1)
+    {
+        fprintf(stderr, "Error reading PPM version\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    if (version[1] != '6')
+    {
+        fprintf(stderr, "Only P6 supported\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+
+    int maxval;
+    if (fscanf(fp, "%d %d %d", &img->width, &img->height, &maxval) != 3)
+    {
+        fprintf(stderr, "Error reading image dimensions\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    if (maxval > 255)
+    {
+        // 16-bit samples are read by read_ppm_deep instead of being truncated here
+        fprintf(stderr, "%s has 16-bit samples (maxval %d); this mode only reads 8-bit PPM\n", filename, maxval);
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    fgetc(fp); // Skip newline
+
+    img->data = (unsigned char *)malloc(img->width * img->height * 3);
+    if (fread(img->data, 1, img->width * img->height * 3, fp) != img->width * img->height * 3)
+    {
+        fprintf(stderr, "Error reading image data\n");
+        fclose(fp);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    fclose(fp);
+    return img;
+}
+
+// Write PPM (P6 format); returns 0 on success
+int write_ppm(const char *filename, PPMImage *img)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        perror("Error opening output file");
+        return -1;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", img->width, img->height);
+    size_t size = (size_t)img->width * img->height * 3;
+    int status = (fwrite(img->data, 1, size, fp) == size) ? 0 : -1;
+    if (fclose(fp) != 0)
+        status = -1;
+    if (status != 0)
+        fprintf(stderr, "Error writing image data to %s\n", filename);
+    return status;
+}
+
+// Read an 8-bit RGB image from a PNG file with the libpng simplified API; grey, palette,
+// 16-bit and alpha images are converted (alpha is composited onto black)
+static PPMImage *read_png(const char *filename)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename))
+    {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        return NULL;
+    }
+    image.format = PNG_FORMAT_RGB;
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    img->width = image.width;
+    img->height = image.height;
+    img->data = (unsigned char *)calloc(PNG_IMAGE_SIZE(image), 1);
+    if (!png_image_finish_read(&image, NULL, img->data, 0, NULL))
+    {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        png_image_free(&image);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+// Input bytes per independently compressed deflate block of the PNG writer (as in pigz)
+#define PNG_BLOCK_BYTES (128 * 1024)
+// Bytes of preceding data used to prime each block's dictionary (the deflate window)
+#define PNG_DICT_BYTES 32768
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static int paeth_predictor(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    return pb <= pc ? b : c;
+}
+
+// Filter one RGB row into out[0..stride) (filter type byte first). All five PNG filters are
+// tried and the one with the smallest sum of absolute signed residuals is kept, which is the
+// heuristic libpng uses. prev is the unfiltered row above (all zero for the first row).
+static void filter_png_row(const unsigned char *row, const unsigned char *prev, int length, unsigned char *out,
+                           unsigned char *candidate)
+{
+    unsigned long best_sum = (unsigned long)-1;
+    for (int type = 0; type < 5; type++)
+    {
+        // The first pixel has no left neighbour (a = c = 0)
+        for (int i = 0; i < 3; i++)
+            candidate[i] = (unsigned char)(row[i] - (type == 2 || type == 4 ? prev[i] : type == 3 ? prev[i] / 2 : 0));
+        if (type == 0)
+            memcpy(candidate, row, length);
+        else if (type == 1)
+            for (int i = 3; i < length; i++)
+                candidate[i] = (unsigned char)(row[i] - row[i - 3]);
+        else if (type == 2)
+            for (int i = 3; i < length; i++)
+                candidate[i] = (unsigned char)(row[i] - prev[i]);
+        else if (type == 3)
+            for (int i = 3; i < length; i++)
+                candidate[i] = (unsigned char)(row[i] - ((row[i - 3] + prev[i]) >> 1));
+        else
+            for (int i = 3; i < length; i++)
+                candidate[i] = (unsigned char)(row[i] - paeth_predictor(row[i - 3], prev[i], prev[i - 3]));
+
+        unsigned long sum = 0;
+        for (int i = 0; i < length; i++)
+            sum += candidate[i] < 128 ? candidate[i] : 256 - candidate[i];
+        if (sum < best_sum)
+        {
+            best_sum = sum;
+            out[0] = (unsigned char)type;
+            memcpy(out + 1, candidate, length);
+        }
+    }
+}
+
+// A piece of the zlib stream inside the IDAT data, with the CRC-32 of its bytes
+typedef struct
+{
+    unsigned char *data;
+    size_t length;
+    uLong crc;
+} PNGPiece;
+
+// Write one chunk with the given type, data and CRC-32 of the data
+static int write_png_chunk(FILE *fp, const char *type, const unsigned char *data, uint32_t length)
+{
+    unsigned char header[8], trailer[4];
+    put_be32(header, length);
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *)type, 4);
+    if (length > 0)
+        crc = crc32(crc, data, length);
+    put_be32(trailer, (uint32_t)crc);
+    return fwrite(header, 1, 8, fp) == 8 && fwrite(data, 1, length, fp) == length && fwrite(trailer, 1, 4, fp) == 4
+               ? 0
+               : -1;
+}
+
+// Write an 8-bit RGB PNG on the OpenMP threads; returns 0 on success. Rows are filtered in
+// parallel, then the filtered data is cut into blocks of about PNG_BLOCK_BYTES that are deflated
+// independently, pigz-style: every block is primed with the 32 KB before it and ends in a sync
+// flush, so the blocks concatenate into one valid zlib stream. The Adler-32 of the stream and the
+// CRC-32 of each IDAT chunk are combined from per-block values with adler32_combine and
+// crc32_combine instead of a serial pass over the output.
+static int write_png(const char *filename, PPMImage *img)
+{
+    int length = img->width * 3;
+    size_t stride = (size_t)length + 1;
+    size_t total = stride * img->height;
+    int rows_per_block = PNG_BLOCK_BYTES / (int)stride > 0 ? PNG_BLOCK_BYTES / (int)stride : 1;
+    int blocks = (img->height + rows_per_block - 1) / rows_per_block;
+
+    unsigned char *filtered = (unsigned char *)malloc(total);
+    PNGPiece *pieces = (PNGPiece *)calloc(blocks + 2, sizeof(PNGPiece)); // header, blocks, trailer
+    uLong *adlers = (uLong *)malloc(blocks * sizeof(uLong));
+    unsigned char *zero_row = (unsigned char *)calloc(length, 1);
+    int failed = 0;
+
+    #pragma omp parallel
+    {
+        unsigned char *scratch = (unsigned char *)malloc(length);
+        #pragma omp for schedule(static)
+        for (int y = 0; y < img->height; y++)
+            filter_png_row(img->data + (size_t)y * length, y > 0 ? img->data + (size_t)(y - 1) * length : zero_row,
+                           length, filtered + y * stride, scratch);
+        free(scratch);
+
+        #pragma omp for schedule(dynamic)
+        for (int k = 0; k < blocks; k++)
+        {
+            size_t start = (size_t)k * rows_per_block * stride;
+            size_t size = k == blocks - 1 ? total - start : (size_t)rows_per_block * stride;
+            z_stream stream;
+            memset(&stream, 0, sizeof(stream));
+            if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            {
+                #pragma omp atomic write
+                failed = 1;
+                continue;
+            }
+            if (start > 0)
+            {
+                size_t dict = start < PNG_DICT_BYTES ? start : PNG_DICT_BYTES;
+                deflateSetDictionary(&stream, filtered + start - dict, (uInt)dict);
+            }
+            size_t bound = deflateBound(&stream, size) + 16;
+            PNGPiece *piece = &pieces[k + 1];
+            piece->data = (unsigned char *)malloc(bound);
+            stream.next_in = filtered + start;
+            stream.avail_in = (uInt)size;
+            stream.next_out = piece->data;
+            stream.avail_out = (uInt)bound;
+            int status = deflate(&stream, k == blocks - 1 ? Z_FINISH : Z_SYNC_FLUSH);
+            if (stream.avail_in != 0 || (k == blocks - 1 ? status != Z_STREAM_END : stream.avail_out == 0))
+            {
+                #pragma omp atomic write
+                failed = 1;
+            }
+            piece->length = bound - stream.avail_out;
+            deflateEnd(&stream);
+            piece->crc = crc32(crc32(0L, Z_NULL, 0), piece->data, (uInt)piece->length);
+            adlers[k] = adler32(adler32(0L, Z_NULL, 0), filtered + start, (uInt)size);
+        }
+    }
+
+    // zlib header (deflate, 32 KB window, default level) and Adler-32 trailer
+    static unsigned char zlib_header[2] = {0x78, 0x9c};
+    unsigned char zlib_trailer[4];
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (int k = 0; k < blocks; k++)
+    {
+        size_t start = (size_t)k * rows_per_block * stride;
+        size_t size = k == blocks - 1 ? total - start : (size_t)rows_per_block * stride;
+        adler = adler32_combine(adler, adlers[k], (z_off_t)size);
+    }
+    put_be32(zlib_trailer, (uint32_t)adler);
+    pieces[0].data = zlib_header;
+    pieces[0].length = 2;
+    pieces[0].crc = crc32(crc32(0L, Z_NULL, 0), zlib_header, 2);
+    pieces[blocks + 1].data = zlib_trailer;
+    pieces[blocks + 1].length = 4;
+    pieces[blocks + 1].crc = crc32(crc32(0L, Z_NULL, 0), zlib_trailer, 4);
+
+    FILE *fp = failed ? NULL : fopen(filename, "wb");
+    if (!fp)
+    {
+        if (failed)
+            fprintf(stderr, "Error compressing PNG %s\n", filename);
+        else
+            perror("Error opening output file");
+        failed = 1;
+    }
+    else
+    {
+        static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        unsigned char ihdr[13];
+        put_be32(ihdr, img->width);
+        put_be32(ihdr + 4, img->height);
+        ihdr[8] = 8;  // bit depth
+        ihdr[9] = 2;  // colour type RGB
+        ihdr[10] = 0; // deflate
+        ihdr[11] = 0; // adaptive filtering
+        ihdr[12] = 0; // no interlace
+        failed = fwrite(signature, 1, 8, fp) != 8 || write_png_chunk(fp, "IHDR", ihdr, 13) != 0;
+
+        // Pieces are grouped into IDAT chunks below the 2^31 - 1 byte chunk limit; the CRC of a
+        // chunk is that of its type combined with the CRCs of its pieces
+        for (int first = 0; first < blocks + 2 && !failed;)
+        {
+            size_t chunk_length = 0;
+            uLong crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef *)"IDAT", 4);
+            int last = first;
+            while (last < blocks + 2 && (last == first || chunk_length + pieces[last].length <= 0x7fffffffu))
+            {
+                crc = crc32_combine(crc, pieces[last].crc, (z_off_t)pieces[last].length);
+                chunk_length += pieces[last].length;
+                last++;
+            }
+            unsigned char header[8], trailer[4];
+            put_be32(header, (uint32_t)chunk_length);
+            memcpy(header + 4, "IDAT", 4);
+            put_be32(trailer, (uint32_t)crc);
+            failed = fwrite(header, 1, 8, fp) != 8;
+            for (int k = first; k < last && !failed; k++)
+                failed = fwrite(pieces[k].data, 1, pieces[k].length, fp) != pieces[k].length;
+            failed = failed || fwrite(trailer, 1, 4, fp) != 4;
+            first = last;
+        }
+        failed = failed || write_png_chunk(fp, "IEND", NULL, 0) != 0;
+        if (fclose(fp) != 0 || failed)
+        {
+            fprintf(stderr, "Error writing PNG %s\n", filename);
+            failed = 1;
+        }
+    }
+
+    for (int k = 0; k < blocks; k++)
+        free(pieces[k + 1].data);
+    free(pieces);
+    free(adlers);
+    free(zero_row);
+    free(filtered);
+    return failed ? -1 : 0;
+}
+
+// True if filename ends in the four-character extension ext (".png", ".tim"; any case)
+int has_extension(const char *filename, const char *ext)
+{
+    size_t length = strlen(filename);
+    if (length < 4)
+        return 0;
+    for (int i = 0; i < 4; i++)
+        if (tolower((unsigned char)filename[length - 4 + i]) != ext[i])
+            return 0;
+    return 1;
+}
+
+// Files ending in ".png" (any case) are PNG, everything else PPM
+int is_png_file(const char *filename)
+{
+    return has_extension(filename, ".png");
+}
+
+// Tiled image container (.tim). Layout, all integers little-endian:
+//   header  "TIM1", width, height, tile width, tile height, channels (3)    (6 x 4 bytes)
+//   index   one entry per tile in row-major tile order: offset (8 bytes), stored size (4),
+//           codec (4; TILE_RAW or TILE_LZ)
+//   data    the tiles, each tile_width x tile_height RGB pixels (clipped at the right and bottom
+//           edges) in row-major order, stored raw or LZ-compressed
+// Every tile can be located from the index, so a region is read by fetching only the tiles it
+// touches, and tiles are read and written in parallel with pread/pwrite.
+#define TILED_HEADER_BYTES 24
+#define TILED_ENTRY_BYTES 16
+
+enum
+{
+    TILE_RAW = 0,
+    TILE_LZ = 1
+};
+
+typedef struct
+{
+    uint64_t offset;
+    uint32_t size; // stored bytes
+    uint32_t codec;
+} TileEntry;
+
+typedef struct
+{
+    int fd;
+    int width, height;
+    int tile_width, tile_height;
+    int tiles_x, tiles_y;
+    TileEntry *index;
+} TiledFile;
+
+// pread/pwrite of a whole buffer at a file offset; return 0 on success
+int pread_full(int fd, void *buf, size_t bytes, off_t offset)
+{
+    while (bytes > 0)
+    {
+        ssize_t n = pread(fd, buf, bytes, offset);
+        if (n <= 0)
+            return -1;
+        buf = (unsigned char *)buf + n;
+        bytes -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+int pwrite_full(int fd, const void *buf, size_t bytes, off_t offset)
+{
+    while (bytes > 0)
+    {
+        ssize_t n = pwrite(fd, buf, bytes, offset);
+        if (n <= 0)
+            return -1;
+        buf = (const unsigned char *)buf + n;
+        bytes -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// LZ4-style block codec: a sequence is a token (literal count in the high nibble, match length
+// - 4 in the low nibble, 15 meaning more length bytes follow, each 255 adding on), the
+// literals, a 16-bit little-endian match offset and the extra match length bytes. As in LZ4 the
+// last 5 bytes are always literals and no match starts in the last 12.
+#define LZ_HASH_BITS 13
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+
+static uint32_t lz_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned char *lz_put_length(unsigned char *op, int length)
+{
+    for (; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+// Compress n bytes into dst; returns the compressed size, or 0 if it would not be smaller than
+// capacity bytes (the caller then stores the data raw)
+static int lz_compress(const unsigned char *src, int n, unsigned char *dst, int capacity)
+{
+    int table[1 << LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+    unsigned char *op = dst;
+    unsigned char *end = dst + capacity;
+    int anchor = 0;
+
+    for (int i = 0; i < n - LZ_MATCH_LIMIT;)
+    {
+        uint32_t sequence = lz_read32(src + i);
+        int hash = (int)((sequence * 2654435761u) >> (32 - LZ_HASH_BITS));
+        int candidate = table[hash];
+        table[hash] = i;
+        if (candidate < 0 || i - candidate > 65535 || lz_read32(src + candidate) != sequence)
+        {
+            i++;
+            continue;
+        }
+        int match = LZ_MIN_MATCH;
+        while (i + match < n - LZ_LAST_LITERALS && src[candidate + match] == src[i + match])
+            match++;
+
+        // token, literal length bytes, literals, offset, match length bytes
+        int literals = i - anchor;
+        if (end - op < 1 + literals / 255 + 1 + literals + 2 + (match - LZ_MIN_MATCH) / 255 + 1)
+            return 0;
+        unsigned char *token = op++;
+        *token = (unsigned char)((literals < 15 ? literals : 15) << 4);
+        if (literals >= 15)
+            op = lz_put_length(op, literals - 15);
+        memcpy(op, src + anchor, literals);
+        op += literals;
+        *op++ = (unsigned char)(i - candidate);
+        *op++ = (unsigned char)((i - candidate) >> 8);
+        *token |= (unsigned char)(match - LZ_MIN_MATCH < 15 ? match - LZ_MIN_MATCH : 15);
+        if (match - LZ_MIN_MATCH >= 15)
+            op = lz_put_length(op, match - LZ_MIN_MATCH - 15);
+        i += match;
+        anchor = i;
+    }
+
+    int literals = n - anchor;
+    if (end - op <= 1 + literals / 255 + 1 + literals)
+        return 0;
+    *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15)
+        op = lz_put_length(op, literals - 15);
+    memcpy(op, src + anchor, literals);
+    op += literals;
+    return (int)(op - dst);
+}
+
+// Decompress n bytes from src into exactly expected bytes at dst; returns 0 on success, -1 on
+// a malformed or truncated block
+static int lz_decompress(const unsigned char *src, int n, unsigned char *dst, int expected)
+{
+    const unsigned char *ip = src, *ip_end = src + n;
+    unsigned char *op = dst, *op_end = dst + expected;
+    while (ip < ip_end)
+    {
+        int token = *ip++;
+        int literals = token >> 4;
+        if (literals == 15)
+        {
+            int more;
+            do
+            {
+                if (ip >= ip_end)
+                    return -1;
+                more = *ip++;
+                literals += more;
+            } while (more == 255);
+        }
+        if (literals > ip_end - ip || literals > op_end - op)
+            return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == ip_end)
+            break;
+
+        if (ip_end - ip < 2)
+            return -1;
+        int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        int match = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15)
+        {
+            int more;
+            do
+            {
+                if (ip >= ip_end)
+                    return -1;
+                more = *ip++;
+                match += more;
+            } while (more == 255);
+        }
+        if (offset == 0 || offset > op - dst || match > op_end - op)
+            return -1;
+        const unsigned char *from = op - offset;
+        for (int i = 0; i < match; i++) // byte by byte: the match may overlap its own output
+            op[i] = from[i];
+        op += match;
+    }
+    return op == op_end ? 0 : -1;
+}
+
+// Pixel rectangle covered by tile (tx, ty)
+static void tile_bounds(const TiledFile *tf, int tx, int ty, int *x, int *y, int *w, int *h)
+{
+    *x = tx * tf->tile_width;
+    *y = ty * tf->tile_height;
+    *w = tf->width - *x < tf->tile_width ? tf->width - *x : tf->tile_width;
+    *h = tf->height - *y < tf->tile_height ? tf->height - *y : tf->tile_height;
+}
+
+// Open a .tim file and load its header and tile index; returns 0 on success
+static int open_tiled(const char *filename, TiledFile *tf)
+{
+    memset(tf, 0, sizeof(*tf));
+    tf->fd = open(filename, O_RDONLY);
+    if (tf->fd < 0)
+    {
+        perror("Error opening tiled image");
+        return -1;
+    }
+    unsigned char header[TILED_HEADER_BYTES];
+    struct stat st;
+    if (fstat(tf->fd, &st) != 0 || pread_full(tf->fd, header, TILED_HEADER_BYTES, 0) != 0 ||
+        memcmp(header, "TIM1", 4) != 0 || get_le32(header + 20) != 3)
+    {
+        fprintf(stderr, "Invalid tiled image format (must be TIM1 with 3 channels)\n");
+        close(tf->fd);
+        return -1;
+    }
+    tf->width = (int)get_le32(header + 4);
+    tf->height = (int)get_le32(header + 8);
+    tf->tile_width = (int)get_le32(header + 12);
+    tf->tile_height = (int)get_le32(header + 16);
+    if (tf->width <= 0 || tf->height <= 0 || tf->tile_width <= 0 || tf->tile_height <= 0)
+    {
+        fprintf(stderr, "Invalid tiled image dimensions\n");
+        close(tf->fd);
+        return -1;
+    }
+    tf->tiles_x = (tf->width + tf->tile_width - 1) / tf->tile_width;
+    tf->tiles_y = (tf->height + tf->tile_height - 1) / tf->tile_height;
+
+    // The tile count comes from the header, so check that the index fits in the file before
+    // sizing any allocation with it
+    size_t count = (size_t)tf->tiles_x * tf->tiles_y;
+    if ((uint64_t)st.st_size < TILED_HEADER_BYTES ||
+        count > ((uint64_t)st.st_size - TILED_HEADER_BYTES) / TILED_ENTRY_BYTES)
+    {
+        fprintf(stderr, "Invalid or truncated tile index in %s\n", filename);
+        close(tf->fd);
+        return -1;
+    }
+    unsigned char *entries = (unsigned char *)malloc(count * TILED_ENTRY_BYTES);
+    tf->index = (TileEntry *)malloc(count * sizeof(TileEntry));
+    if (!entries || !tf->index)
+    {
+        fprintf(stderr, "Out of memory reading the tile index of %s\n", filename);
+        free(entries);
+        free(tf->index);
+        close(tf->fd);
+        return -1;
+    }
+    int status = pread_full(tf->fd, entries, count * TILED_ENTRY_BYTES, TILED_HEADER_BYTES);
+    for (size_t t = 0; t < count && status == 0; t++)
+    {
+        const unsigned char *entry = entries + t * TILED_ENTRY_BYTES;
+        int x, y, w, h;
+        tile_bounds(tf, (int)(t % tf->tiles_x), (int)(t / tf->tiles_x), &x, &y, &w, &h);
+        tf->index[t].offset = get_le32(entry) | (uint64_t)get_le32(entry + 4) << 32;
+        tf->index[t].size = get_le32(entry + 8);
+        tf->index[t].codec = get_le32(entry + 12);
+        if (tf->index[t].offset + tf->index[t].size > (uint64_t)st.st_size ||
+            tf->index[t].size > (uint32_t)w * h * 3 || tf->index[t].codec > TILE_LZ ||
+            (tf->index[t].codec == TILE_RAW && tf->index[t].size != (uint32_t)w * h * 3))
+            status = -1;
+    }
+    free(entries);
+    if (status != 0)
+    {
+        fprintf(stderr, "Invalid or truncated tile index in %s\n", filename);
+        free(tf->index);
+        close(tf->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void close_tiled(TiledFile *tf)
+{
+    free(tf->index);
+    close(tf->fd);
+}
+
+// Read the region [x, x + width) x [y, y + height) of a .tim file, clipped to the image. Only the
+// tiles overlapping the region are read; they are fetched and decompressed on all threads.
+PPMImage *read_tiled_region(const char *filename, int x, int y, int width, int height)
+{
+    TiledFile tf;
+    if (open_tiled(filename, &tf) != 0)
+        return NULL;
+    // A negative origin clips the region instead of moving it
+    if (x < 0)
+    {
+        width += x;
+        x = 0;
+    }
+    if (y < 0)
+    {
+        height += y;
+        y = 0;
+    }
+    width = width < tf.width - x ? width : tf.width - x;
+    height = height < tf.height - y ? height : tf.height - y;
+    if (width <= 0 || height <= 0)
+    {
+        fprintf(stderr, "Region lies outside the %dx%d image\n", tf.width, tf.height);
+        close_tiled(&tf);
+        return NULL;
+    }
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    img->width = width;
+    img->height = height;
+    img->data = (unsigned char *)malloc((size_t)width * height * 3);
+
+    int tx0 = x / tf.tile_width, tx1 = (x + width - 1) / tf.tile_width;
+    int ty0 = y / tf.tile_height, ty1 = (y + height - 1) / tf.tile_height;
+    int failed = 0;
+    #pragma omp parallel
+    {
+        size_t tile_bytes = (size_t)tf.tile_width * tf.tile_height * 3;
+        unsigned char *stored = (unsigned char *)malloc(tile_bytes);
+        unsigned char *tile = (unsigned char *)malloc(tile_bytes);
+        #pragma omp for collapse(2) schedule(dynamic)
+        for (int ty = ty0; ty <= ty1; ty++)
+        {
+            for (int tx = tx0; tx <= tx1; tx++)
+            {
+                const TileEntry *entry = &tf.index[(size_t)ty * tf.tiles_x + tx];
+                int bx, by, bw, bh;
+                tile_bounds(&tf, tx, ty, &bx, &by, &bw, &bh);
+                const unsigned char *pixels = stored;
+                int status = pread_full(tf.fd, stored, entry->size, (off_t)entry->offset);
+                if (status == 0 && entry->codec == TILE_LZ)
+                {
+                    status = lz_decompress(stored, (int)entry->size, tile, bw * bh * 3);
+                    pixels = tile;
+                }
+                if (status != 0)
+                {
+                    #pragma omp atomic write
+                    failed = 1;
+                    continue;
+                }
+                // Copy the part of the tile inside the region
+                int cx0 = bx > x ? bx : x, cx1 = bx + bw < x + width ? bx + bw : x + width;
+                int cy0 = by > y ? by : y, cy1 = by + bh < y + height ? by + bh : y + height;
+                for (int row = cy0; row < cy1; row++)
+                    memcpy(img->data + ((size_t)(row - y) * width + (cx0 - x)) * 3,
+                           pixels + ((size_t)(row - by) * bw + (cx0 - bx)) * 3, (size_t)(cx1 - cx0) * 3);
+            }
+        }
+        free(stored);
+        free(tile);
+    }
+    close_tiled(&tf);
+    if (failed)
+    {
+        fprintf(stderr, "Error reading tiles from %s\n", filename);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+static PPMImage *read_tiled(const char *filename)
+{
+    return read_tiled_region(filename, 0, 0, INT_MAX, INT_MAX);
+}
+
+// Write img as a .tim file with square tiles of tile_size pixels; returns 0 on success. Tiles
+// are compressed in parallel and kept compressed only where that is smaller; once their sizes
+// are known the offsets are assigned and the tiles are written in parallel with pwrite.
+int write_tiled(const char *filename, PPMImage *img, int tile_size)
+{
+    TiledFile tf;
+    tf.width = img->width;
+    tf.height = img->height;
+    tf.tile_width = tf.tile_height = tile_size;
+    tf.tiles_x = (img->width + tile_size - 1) / tile_size;
+    tf.tiles_y = (img->height + tile_size - 1) / tile_size;
+    int count = tf.tiles_x * tf.tiles_y;
+    size_t index_bytes = (size_t)count * TILED_ENTRY_BYTES;
+    unsigned char *header = (unsigned char *)calloc(TILED_HEADER_BYTES + index_bytes, 1);
+    unsigned char **tiles = (unsigned char **)calloc(count, sizeof(unsigned char *));
+    tf.index = (TileEntry *)malloc(count * sizeof(TileEntry));
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("Error opening output file");
+        free(header);
+        free(tiles);
+        free(tf.index);
+        return -1;
+    }
+
+    int failed = 0;
+    #pragma omp parallel
+    {
+        unsigned char *raw = (unsigned char *)malloc((size_t)tile_size * tile_size * 3);
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < count; t++)
+        {
+            int bx, by, bw, bh;
+            tile_bounds(&tf, t % tf.tiles_x, t / tf.tiles_x, &bx, &by, &bw, &bh);
+            int bytes = bw * bh * 3;
+            for (int row = 0; row < bh; row++)
+                memcpy(raw + (size_t)row * bw * 3, img->data + ((size_t)(by + row) * img->width + bx) * 3,
+                       (size_t)bw * 3);
+            tiles[t] = (unsigned char *)malloc(bytes);
+            int size = lz_compress(raw, bytes, tiles[t], bytes);
+            tf.index[t].codec = size > 0 ? TILE_LZ : TILE_RAW;
+            tf.index[t].size = size > 0 ? (uint32_t)size : (uint32_t)bytes;
+            if (size == 0)
+                memcpy(tiles[t], raw, bytes);
+        }
+        free(raw);
+
+        #pragma omp single
+        {
+            uint64_t offset = TILED_HEADER_BYTES + index_bytes;
+            for (int t = 0; t < count; t++)
+            {
+                tf.index[t].offset = offset;
+                offset += tf.index[t].size;
+            }
+        }
+
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < count; t++)
+        {
+            if (pwrite_full(fd, tiles[t], tf.index[t].size, (off_t)tf.index[t].offset) != 0)
+            {
+                #pragma omp atomic write
+                failed = 1;
+            }
+            free(tiles[t]);
+        }
+    }
+
+    memcpy(header, "TIM1", 4);
+    put_le32(header + 4, img->width);
+    put_le32(header + 8, img->height);
+    put_le32(header + 12, tile_size);
+    put_le32(header + 16, tile_size);
+    put_le32(header + 20, 3);
+    for (int t = 0; t < count; t++)
+    {
+        unsigned char *entry = header + TILED_HEADER_BYTES + (size_t)t * TILED_ENTRY_BYTES;
+        put_le32(entry, (uint32_t)tf.index[t].offset);
+        put_le32(entry + 4, (uint32_t)(tf.index[t].offset >> 32));
+        put_le32(entry + 8, tf.index[t].size);
+        put_le32(entry + 12, tf.index[t].codec);
+    }
+    failed = failed || pwrite_full(fd, header, TILED_HEADER_BYTES + index_bytes, 0) != 0;
+    if (close(fd) != 0 || failed)
+    {
+        fprintf(stderr, "Error writing tiled image %s\n", filename);
+        failed = 1;
+    }
+    free(header);
+    free(tiles);
+    free(tf.index);
+    return failed ? -1 : 0;
+}
+
+// Picks the format by extension: .png, .tim (tiled container) or PPM
+PPMImage *read_image(const char *filename)
+{
+    if (has_extension(filename, ".tim"))
+        return read_tiled(filename);
+    return is_png_file(filename) ? read_png(filename) : read_ppm(filename);
+}
+
+// Returns 0 on success
+int write_image(const char *filename, PPMImage *img)
+{
+    if (has_extension(filename, ".tim"))
+        return write_tiled(filename, img, TILED_DEFAULT_TILE);
+    if (is_png_file(filename))
+        return write_png(filename, img);
+    return write_ppm(filename, img);
+}
+
+size_t sample_size(int type)
+{
+    return type == SAMPLE_U8 ? 1 : type == SAMPLE_U16 ? 2 : sizeof(float);
+}
+
+// Convert between big-endian file order and host order in place (its own inverse). Written as
+// a plain shift loop so the compiler vectorises it.
+static void swap_be16(uint16_t *data, long count)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #pragma omp parallel for simd
+    for (long i = 0; i < count; i++)
+        data[i] = (uint16_t)(data[i] << 8 | data[i] >> 8);
+#else
+    (void)data;
+    (void)count;
+#endif
+}
+
+// Read the maxval of a P6 file, or -1 if it cannot be parsed
+int ppm_maxval(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return -1;
+    int width, height, maxval;
+    int parsed = fscanf(fp, "P6 %d %d %d", &width, &height, &maxval) == 3;
+    fclose(fp);
+    return parsed ? maxval : -1;
+}
+
+// Read a P6 file of any depth: 8-bit files give SAMPLE_U8, maxval 256..65535 gives SAMPLE_U16
+DeepImage *read_ppm_deep(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        perror("Error opening file");
+        return NULL;
+    }
+    DeepImage *img = (DeepImage *)malloc(sizeof(DeepImage));
+    if (fscanf(fp, "P6 %d %d %d", &img->width, &img->height, &img->maxval) != 3 || img->width <= 0 ||
+        img->height <= 0 || img->maxval <= 0 || img->maxval > 65535)
+    {
+        fprintf(stderr, "Error reading P6 header (maxval must be 1..65535)\n");
+        fclose(fp);
+        free(img);
+        return NULL;
+    }
+    fgetc(fp); // Skip newline
+
+    img->type = img->maxval > 255 ? SAMPLE_U16 : SAMPLE_U8;
+    long count = (long)img->width * img->height * 3;
+    img->data = malloc(count * sample_size(img->type));
+    if (fread(img->data, sample_size(img->type), count, fp) != (size_t)count)
+    {
+        fprintf(stderr, "Error reading image data\n");
+        fclose(fp);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    fclose(fp);
+    if (img->type == SAMPLE_U16)
+        swap_be16((uint16_t *)img->data, count);
+    return img;
+}
+
+// Write a SAMPLE_U8 or SAMPLE_U16 image as P6 with its maxval; returns 0 on success
+int write_ppm_deep(const char *filename, DeepImage *img)
+{
+    long count = (long)img->width * img->height * 3;
+    size_t size = sample_size(img->type);
+    void *file_order = img->data;
+    if (img->type == SAMPLE_U16)
+    {
+        file_order = malloc(count * size);
+        memcpy(file_order, img->data, count * size);
+        swap_be16((uint16_t *)file_order, count);
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    int failed = !fp;
+    if (fp)
+    {
+        fprintf(fp, "P6\n%d %d\n%d\n", img->width, img->height, img->maxval);
+        failed = fwrite(file_order, size, count, fp) != (size_t)count;
+        failed = fclose(fp) != 0 || failed;
+    }
+    if (failed)
+        perror("Error writing output file");
+    if (file_order != img->data)
+        free(file_order);
+    return failed ? -1 : 0;
+}
+
+// Copy of img with samples of the given type. Conversion to an integer type rounds and clamps
+// to [0, maxval].
+DeepImage *convert_samples(const DeepImage *img, int type)
+{
+    long count = (long)img->width * img->height * 3;
+    DeepImage *out = (DeepImage *)malloc(sizeof(DeepImage));
+    *out = *img;
+    out->type = type;
+    out->data = malloc(count * sample_size(type));
+    float maxval = (float)img->maxval;
+    float bias = (type != SAMPLE_F32 && img->type == SAMPLE_F32) ? 0.5f : 0.0f;
+    #pragma omp parallel for
+    for (long i = 0; i < count; i++)
+        sample_store(out->data, i, fminf(sample_load(img->data, i, img->type) + bias, maxval), type);
+    return out;
+}
+
+void free_deep(DeepImage *img)
+{
+    free(img->data);
+    free(img);
+}
+
+// Add one image; without an explicit output it is written to output_dir under its own name
+static void batch_add(BatchList *list, const char *input, const char *output, const char *output_dir)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->inputs = (char **)realloc(list->inputs, list->capacity * sizeof(char *));
+        list->outputs = (char **)realloc(list->outputs, list->capacity * sizeof(char *));
+    }
+    list->inputs[list->count] = strdup(input);
+    if (output)
+    {
+        list->outputs[list->count] = strdup(output);
+    }
+    else
+    {
+        const char *slash = strrchr(input, '/');
+        const char *name = slash ? slash + 1 : input;
+        list->outputs[list->count] = (char *)malloc(strlen(output_dir) + strlen(name) + 2);
+        sprintf(list->outputs[list->count], "%s/%s", output_dir, name);
+    }
+    list->count++;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Collect the images of a batch from source, which is a directory (every .ppm, .png and .tim
+// file in it, in name order), a glob pattern such as "frames/*.ppm", or a manifest file with
+// one "input [output]" pair per line (# starts a comment). Returns the number of images, or -1
+// on error.
+int collect_batch(const char *source, const char *output_dir, BatchList *list)
+{
+    memset(list, 0, sizeof(*list));
+    struct stat st;
+    if (stat(source, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(source);
+        if (!dir)
+        {
+            perror("Error opening batch directory");
+            return -1;
+        }
+        char **names = NULL;
+        int count = 0, capacity = 0;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (!has_extension(entry->d_name, ".ppm") && !has_extension(entry->d_name, ".png") &&
+                !has_extension(entry->d_name, ".tim"))
+                continue;
+            if (count == capacity)
+            {
+                capacity = capacity ? 2 * capacity : 64;
+                names = (char **)realloc(names, capacity * sizeof(char *));
+            }
+            names[count] = (char *)malloc(strlen(source) + strlen(entry->d_name) + 2);
+            sprintf(names[count++], "%s/%s", source, entry->d_name);
+        }
+        closedir(dir);
+        qsort(names, count, sizeof(char *), compare_names);
+        for (int i = 0; i < count; i++)
+        {
+            batch_add(list, names[i], NULL, output_dir);
+            free(names[i]);
+        }
+        free(names);
+    }
+    else if (strpbrk(source, "*?["))
+    {
+        glob_t matches;
+        int status = glob(source, 0, NULL, &matches);
+        if (status != 0 && status != GLOB_NOMATCH)
+        {
+            fprintf(stderr, "Error expanding %s\n", source);
+            return -1;
+        }
+        for (size_t i = 0; status == 0 && i < matches.gl_pathc; i++)
+            batch_add(list, matches.gl_pathv[i], NULL, output_dir);
+        if (status == 0)
+            globfree(&matches);
+    }
+    else
+    {
+        FILE *fp = fopen(source, "r");
+        if (!fp)
+        {
+            perror("Error opening batch manifest");
+            return -1;
+        }
+        char line[8192], input[4096], output[4096];
+        while (fgets(line, sizeof(line), fp))
+        {
+            int fields = sscanf(line, "%4095s %4095s", input, output);
+            if (fields < 1 || input[0] == '#')
+                continue;
+            batch_add(list, input, fields == 2 && output[0] != '#' ? output : NULL, output_dir);
+        }
+        fclose(fp);
+    }
+
+    if (mkdir(output_dir, 0755) != 0 && errno != EEXIST)
+    {
+        perror("Error creating batch output directory");
+        return -1;
+    }
+    return list->count;
+}
+
+void free_batch(BatchList *list)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        free(list->inputs[i]);
+        free(list->outputs[i]);
+    }
+    free(list->inputs);
+    free(list->outputs);
+}
+
+// PPM image backed by a memory mapping of its file; image.data points into the mapping just
+// past the header, so the pixels are never copied. Created by map_ppm / create_mapped_ppm and
+// released with unmap_ppm.
+typedef struct
+{
+    PPMImage image;
+    unsigned char *base;
+    size_t length;
+} MappedPPM;
+
+// Parse the next header number of a P6 file in memory, skipping whitespace and comments
+static int parse_ppm_number(const unsigned char *p, size_t length, size_t *pos, int *value)
+{
+    while (*pos < length && (isspace(p[*pos]) || p[*pos] == '#'))
+    {
+        if (p[*pos] == '#')
+            while (*pos < length && p[*pos] != '\n')
+                (*pos)++;
+        else
+            (*pos)++;
+    }
+    if (*pos >= length || !isdigit(p[*pos]))
+        return -1;
+    *value = 0;
+    while (*pos < length && isdigit(p[*pos]))
+        *value = *value * 10 + (p[(*pos)++] - '0');
+    return 0;
+}
+
+// Map a P6 file read-only. The kernel is told the pixels are read once from front to back and
+// starts reading them ahead while the caller computes.
+PPMImage *map_ppm(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("Error opening file");
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 2)
+    {
+        fprintf(stderr, "Error reading PPM size\n");
+        close(fd);
+        return NULL;
+    }
+    size_t length = (size_t)st.st_size;
+    unsigned char *base = (unsigned char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("Error mapping file");
+        return NULL;
+    }
+
+    size_t pos = 2;
+    int width, height, maxval;
+    if (base[0] != 'P' || base[1] != '6' || parse_ppm_number(base, length, &pos, &width) ||
+        parse_ppm_number(base, length, &pos, &height) || parse_ppm_number(base, length, &pos, &maxval) ||
+        maxval != 255 || pos + 1 + (size_t)width * height * 3 > length)
+    {
+        fprintf(stderr, "Only complete 8-bit P6 files can be mapped\n");
+        munmap(base, length);
+        return NULL;
+    }
+    pos++; // single whitespace after maxval
+
+    madvise(base, length, MADV_SEQUENTIAL);
+    madvise(base, length, MADV_WILLNEED);
+
+    MappedPPM *mapped = (MappedPPM *)malloc(sizeof(MappedPPM));
+    mapped->image.width = width;
+    mapped->image.height = height;
+    mapped->image.data = base + pos;
+    mapped->base = base;
+    mapped->length = length;
+    return &mapped->image;
+}
+
+// Create a P6 file of the given size and map it shared and writable; pixels written to data
+// go straight to the page cache of the file
+PPMImage *create_mapped_ppm(const char *filename, int width, int height)
+{
+    char header[64];
+    int header_length = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    size_t length = header_length + (size_t)width * height * 3;
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("Error creating output file");
+        return NULL;
+    }
+    if (ftruncate(fd, length) != 0)
+    {
+        perror("Error sizing output file");
+        close(fd);
+        return NULL;
+    }
+    unsigned char *base = (unsigned char *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        perror("Error mapping output file");
+        return NULL;
+    }
+    memcpy(base, header, header_length);
+
+    MappedPPM *mapped = (MappedPPM *)malloc(sizeof(MappedPPM));
+    mapped->image.width = width;
+    mapped->image.height = height;
+    mapped->image.data = base + header_length;
+    mapped->base = base;
+    mapped->length = length;
+    return &mapped->image;
+}
+
+// Release an image from map_ppm or create_mapped_ppm; returns 0 on success
+int unmap_ppm(PPMImage *img)
+{
+    MappedPPM *mapped = (MappedPPM *)img;
+    int status = munmap(mapped->base, mapped->length);
+    if (status != 0)
+        perror("Error unmapping file");
+    free(mapped);
+    return status;
+}
+
+// io_uring engine for batch runs, on the raw system calls (no liburing). A pool of buffers,
+// registered with the kernel when the memlock limit allows, cycles through read -> filter in
+// place -> write: up to depth input files are read ahead of the filter while finished images
+// are written behind it, so storage and compute overlap and batch throughput approaches the
+// larger of the two instead of their sum. Inputs and outputs are 8-bit PPM files.
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    unsigned sq_local_tail; // queued but not yet published SQEs end here
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_bytes, cq_ring_bytes, sqes_bytes;
+} URing;
+
+static int uring_init(URing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return -1;
+    ring->entries = params.sq_entries;
+    ring->sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        // One mapping holds both rings
+        if (ring->cq_ring_bytes > ring->sq_ring_bytes)
+            ring->sq_ring_bytes = ring->cq_ring_bytes;
+        ring->cq_ring_bytes = 0;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->cq_ring_bytes ? mmap(NULL, ring->cq_ring_bytes, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING)
+                                        : ring->sq_ring;
+    ring->sqes_bytes = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_bytes, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        close(ring->fd);
+        return -1;
+    }
+
+    unsigned char *sq = (unsigned char *)ring->sq_ring, *cq = (unsigned char *)ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+    return 0;
+}
+
+static void uring_free(URing *ring)
+{
+    munmap(ring->sqes, ring->sqes_bytes);
+    if (ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_bytes);
+    munmap(ring->sq_ring, ring->sq_ring_bytes);
+    close(ring->fd);
+}
+
+// Next free submission entry, zeroed, or NULL if the queue is full
+static struct io_uring_sqe *uring_sqe(URing *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->entries)
+        return NULL;
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+// Submit the queued entries and, if wait is set, block until at least one completion is there
+static int uring_submit(URing *ring, int wait)
+{
+    unsigned submit = ring->sq_local_tail - *ring->sq_tail;
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    if (submit == 0 && !wait)
+        return 0;
+    long status;
+    do
+        status = syscall(__NR_io_uring_enter, ring->fd, submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                         NULL, 0);
+    while (status < 0 && errno == EINTR);
+    return status < 0 ? -1 : 0;
+}
+
+// Take the next completion, if any; returns 1 if *cqe was filled
+static int uring_completion(URing *ring, struct io_uring_cqe *cqe)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    *cqe = ring->cqes[head & *ring->cq_mask];
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+enum
+{
+    SLOT_FREE,
+    SLOT_READING,
+    SLOT_READY,
+    SLOT_WRITING
+};
+
+// One pool buffer and the transfer it is part of
+typedef struct
+{
+    unsigned char *data;
+    int state;
+    int image;    // batch index
+    int fd;
+    size_t length; // bytes to transfer
+    size_t done;   // bytes transferred so far
+} IOSlot;
+
+// Queue the rest of slot's read or write (fixed-buffer ops when the pool is registered)
+static int uring_queue_transfer(URing *ring, IOSlot *slots, int index, int registered)
+{
+    IOSlot *slot = &slots[index];
+    struct io_uring_sqe *sqe = uring_sqe(ring);
+    if (!sqe)
+        return -1;
+    int write = slot->state == SLOT_WRITING;
+    sqe->opcode = registered ? (write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED)
+                             : (write ? IORING_OP_WRITE : IORING_OP_READ);
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->data + slot->done);
+    sqe->len = (uint32_t)(slot->length - slot->done);
+    sqe->off = slot->done;
+    sqe->buf_index = registered ? index : 0;
+    sqe->user_data = index;
+    return 0;
+}
+
+// Run filter over every image of list with io_uring reads and writes; returns the number of
+// images that failed, or -1 if io_uring cannot be used
+int uring_batch_run(const BatchList *list, int depth, BatchFilter filter, void *context)
+{
+    // The pool holds depth reads ahead, the image being filtered and up to depth writes behind
+    size_t capacity = 0;
+    for (int k = 0; k < list->count; k++)
+    {
+        struct stat st;
+        if (stat(list->inputs[k], &st) == 0 && (size_t)st.st_size > capacity)
+            capacity = st.st_size;
+    }
+    int slots_count = 2 * depth + 1;
+    URing ring;
+    unsigned entries = 1;
+    while (entries < (unsigned)slots_count)
+        entries <<= 1;
+    if (uring_init(&ring, entries) != 0)
+    {
+        perror("io_uring_setup");
+        return -1;
+    }
+
+    IOSlot *slots = (IOSlot *)calloc(slots_count, sizeof(IOSlot));
+    struct iovec *iovecs = (struct iovec *)malloc(slots_count * sizeof(struct iovec));
+    for (int i = 0; i < slots_count; i++)
+    {
+        slots[i].data = (unsigned char *)malloc(capacity);
+        iovecs[i].iov_base = slots[i].data;
+        iovecs[i].iov_len = capacity;
+    }
+    // Registered buffers are pinned once instead of on every transfer; without them (memlock
+    // limit) the plain read/write opcodes are used
+    int registered = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iovecs, slots_count) == 0;
+    free(iovecs);
+
+    int next_read = 0, finished = 0, failed = 0;
+    while (finished < list->count)
+    {
+        // Keep up to depth reads in flight ahead of the filter
+        int ahead = 0;
+        for (int i = 0; i < slots_count; i++)
+            ahead += slots[i].state == SLOT_READING || slots[i].state == SLOT_READY;
+        for (int i = 0; i < slots_count && ahead < depth && next_read < list->count; i++)
+        {
+            if (slots[i].state != SLOT_FREE)
+                continue;
+            int k = next_read++;
+            struct stat st;
+            int fd = open(list->inputs[k], O_RDONLY);
+            if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0 ||
+                (size_t)st.st_size > capacity)
+            {
+                fprintf(stderr, "Skipping %s\n", list->inputs[k]);
+                if (fd >= 0)
+                    close(fd);
+                failed++;
+                finished++;
+                continue;
+            }
+            slots[i] = (IOSlot){slots[i].data, SLOT_READING, k, fd, (size_t)st.st_size, 0};
+            uring_queue_transfer(&ring, slots, i, registered);
+            ahead++;
+        }
+        if (finished == list->count)
+            break;
+
+        // Filter the oldest image that has arrived; its write goes out without waiting
+        int ready = -1;
+        for (int i = 0; i < slots_count; i++)
+            if (slots[i].state == SLOT_READY && (ready < 0 || slots[i].image < slots[ready].image))
+                ready = i;
+        if (ready >= 0)
+        {
+            uring_submit(&ring, 0); // the reads queued above proceed during the filter
+            IOSlot *slot = &slots[ready];
+            size_t pos = 2;
+            int width, height, maxval;
+            int fd = -1;
+            if (slot->length >= 2 && slot->data[0] == 'P' && slot->data[1] == '6' &&
+                !parse_ppm_number(slot->data, slot->length, &pos, &width) &&
+                !parse_ppm_number(slot->data, slot->length, &pos, &height) &&
+                !parse_ppm_number(slot->data, slot->length, &pos, &maxval) && maxval == 255 &&
+                pos + 1 + (size_t)width * height * 3 <= slot->length)
+            {
+                // The output keeps the input header; only the pixels change
+                filter(slot->data + pos + 1, width, height, context);
+                fd = open(list->outputs[slot->image], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            }
+            if (fd < 0)
+            {
+                fprintf(stderr, "Skipping %s\n", list->inputs[slot->image]);
+                slot->state = SLOT_FREE;
+                failed++;
+                finished++;
+                continue;
+            }
+            slot->state = SLOT_WRITING;
+            slot->fd = fd;
+            slot->length = pos + 1 + (size_t)width * height * 3;
+            slot->done = 0;
+            uring_queue_transfer(&ring, slots, ready, registered);
+            uring_submit(&ring, 0);
+        }
+        else if (uring_submit(&ring, 1) != 0)
+        {
+            perror("io_uring_enter");
+            break;
+        }
+
+        struct io_uring_cqe cqe;
+        while (uring_completion(&ring, &cqe))
+        {
+            IOSlot *slot = &slots[cqe.user_data];
+            if (cqe.res > 0)
+                slot->done += cqe.res;
+            if (cqe.res > 0 && slot->done < slot->length)
+            {
+                uring_queue_transfer(&ring, slots, (int)cqe.user_data, registered); // short transfer
+                continue;
+            }
+            close(slot->fd);
+            if (cqe.res <= 0)
+            {
+                fprintf(stderr, "Error %s %s: %s\n", slot->state == SLOT_WRITING ? "writing" : "reading",
+                        slot->state == SLOT_WRITING ? list->outputs[slot->image] : list->inputs[slot->image],
+                        strerror(cqe.res < 0 ? -cqe.res : EIO));
+                slot->state = SLOT_FREE;
+                failed++;
+                finished++;
+            }
+            else if (slot->state == SLOT_READING)
+            {
+                slot->state = SLOT_READY;
+            }
+            else
+            {
+                slot->state = SLOT_FREE;
+                finished++;
+            }
+        }
+        uring_submit(&ring, 0);
+    }
+
+    for (int i = 0; i < slots_count; i++)
+        free(slots[i].data);
+    free(slots);
+    uring_free(&ring);
+    return failed;
+}
+
+static inline unsigned char clamp_sample(float value)
+{
+    return (unsigned char)(fminf(fmaxf(value, 0.0f), 255.0f) + 0.5f);
+}
+
+// Convert to full-range BT.601 YCbCr. Every chroma sample is taken from the mean RGB of its
+// 2x2 block (the conversion is linear, so this equals the mean of the full-resolution chroma).
+YCbCrImage *rgb_to_ycbcr420(const PPMImage *img)
+{
+    YCbCrImage *ycc = (YCbCrImage *)malloc(sizeof(YCbCrImage));
+    ycc->width = img->width;
+    ycc->height = img->height;
+    ycc->chroma_width = (img->width + 1) / 2;
+    ycc->chroma_height = (img->height + 1) / 2;
+    ycc->luma = (unsigned char *)malloc(img->width * img->height);
+    ycc->chroma = (unsigned char *)malloc(ycc->chroma_width * ycc->chroma_height * 2);
+
+    const unsigned char *rgb = img->data;
+    #pragma omp parallel for simd
+    for (int i = 0; i < img->width * img->height; i++)
+        ycc->luma[i] = clamp_sample(0.299f * rgb[i * 3] + 0.587f * rgb[i * 3 + 1] + 0.114f * rgb[i * 3 + 2]);
+
+    #pragma omp parallel for
+    for (int cy = 0; cy < ycc->chroma_height; cy++)
+    {
+        for (int cx = 0; cx < ycc->chroma_width; cx++)
+        {
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            int count = 0;
+            for (int y = 2 * cy; y < 2 * cy + 2 && y < img->height; y++)
+            {
+                for (int x = 2 * cx; x < 2 * cx + 2 && x < img->width; x++)
+                {
+                    const unsigned char *p = rgb + (y * img->width + x) * 3;
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                    count++;
+                }
+            }
+            r /= count;
+            g /= count;
+            b /= count;
+            unsigned char *q = ycc->chroma + (cy * ycc->chroma_width + cx) * 2;
+            q[0] = clamp_sample(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+            q[1] = clamp_sample(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+        }
+    }
+    return ycc;
+}
+
+// Upsample the chroma bilinearly (chroma sample i sits between luma pixels 2i and 2i + 1) and
+// convert back to RGB
+void ycbcr420_to_rgb(const YCbCrImage *ycc, PPMImage *img)
+{
+    int cw = ycc->chroma_width, ch = ycc->chroma_height;
+
+    #pragma omp parallel for
+    for (int y = 0; y < ycc->height; y++)
+    {
+        float fy = y * 0.5f - 0.25f;
+        int y0 = (int)floorf(fy);
+        float wy = fy - y0;
+        int y1 = (y0 + 1 < ch) ? y0 + 1 : ch - 1;
+        if (y0 < 0)
+            y0 = 0;
+
+        for (int x = 0; x < ycc->width; x++)
+        {
+            float fx = x * 0.5f - 0.25f;
+            int x0 = (int)floorf(fx);
+            float wx = fx - x0;
+            int x1 = (x0 + 1 < cw) ? x0 + 1 : cw - 1;
+            if (x0 < 0)
+                x0 = 0;
+
+            float chroma[2];
+            for (int c = 0; c < 2; c++)
+            {
+                float top = (1.0f - wx) * ycc->chroma[(y0 * cw + x0) * 2 + c] + wx * ycc->chroma[(y0 * cw + x1) * 2 + c];
+                float bottom = (1.0f - wx) * ycc->chroma[(y1 * cw + x0) * 2 + c] + wx * ycc->chroma[(y1 * cw + x1) * 2 + c];
+                chroma[c] = (1.0f - wy) * top + wy * bottom - 128.0f;
+            }
+
+            float luma = ycc->luma[y * ycc->width + x];
+            unsigned char *p = img->data + (y * ycc->width + x) * 3;
+            p[0] = clamp_sample(luma + 1.402f * chroma[1]);
+            p[1] = clamp_sample(luma - 0.344136f * chroma[0] - 0.714136f * chroma[1]);
+            p[2] = clamp_sample(luma + 1.772f * chroma[0]);
+        }
+    }
+}
+
+void free_ycbcr(YCbCrImage *ycc)
+{
+    free(ycc->luma);
+    free(ycc->chroma);
+    free(ycc);
+}
@@ -0,0 +1,119 @@
+// Image input and output shared by graph_denoise_rgb.c, median_denoise_rgb.c and
+// tiled_convert.c: PPM (8 and 16 bit), PNG, the tiled .tim container, memory-mapped PPM files,
+// batch file lists, the io_uring batch engine and the YCbCr 4:2:0 conversion.
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct
+{
+    int width;
+    int height;
+    unsigned char *data; // RGB data stored as [R, G, B, R, G, B, ...]
+} PPMImage;
+
+// 8-bit PPM (P6) files
+PPMImage *read_ppm(const char *filename);
+int write_ppm(const char *filename, PPMImage *img);
+
+int has_extension(const char *filename, const char *ext);
+int is_png_file(const char *filename);
+
+int pread_full(int fd, void *buf, size_t bytes, off_t offset);
+int pwrite_full(int fd, const void *buf, size_t bytes, off_t offset);
+
+// Tiled .tim container
+#define TILED_DEFAULT_TILE 256
+
+PPMImage *read_tiled_region(const char *filename, int x, int y, int width, int height);
+int write_tiled(const char *filename, PPMImage *img, int tile_size);
+
+// PNG, .tim or PPM, picked by extension
+PPMImage *read_image(const char *filename);
+int write_image(const char *filename, PPMImage *img);
+
+// Sample types of the high-bit-depth pipeline. PPM files with maxval > 255 store two bytes
+// per sample, big-endian.
+enum
+{
+    SAMPLE_U8,
+    SAMPLE_U16,
+    SAMPLE_F32
+};
+
+typedef struct
+{
+    int width;
+    int height;
+    int maxval; // largest sample value: 255 for 8-bit data, up to 65535
+    int type;   // SAMPLE_*; float samples are kept in [0, maxval]
+    void *data; // width * height * 3 samples, RGB interleaved
+} DeepImage;
+
+size_t sample_size(int type);
+
+static inline __attribute__((always_inline)) float sample_load(const void *buf, size_t idx, int type)
+{
+    if (type == SAMPLE_U8)
+        return ((const unsigned char *)buf)[idx];
+    if (type == SAMPLE_U16)
+        return ((const uint16_t *)buf)[idx];
+    return ((const float *)buf)[idx];
+}
+
+// value must already be within [0, maxval]; integer types truncate like the uint8 kernels
+static inline __attribute__((always_inline)) void sample_store(void *buf, size_t idx, float value, int type)
+{
+    if (type == SAMPLE_U8)
+        ((unsigned char *)buf)[idx] = (unsigned char)value;
+    else if (type == SAMPLE_U16)
+        ((uint16_t *)buf)[idx] = (uint16_t)value;
+    else
+        ((float *)buf)[idx] = value;
+}
+
+int ppm_maxval(const char *filename);
+DeepImage *read_ppm_deep(const char *filename);
+int write_ppm_deep(const char *filename, DeepImage *img);
+DeepImage *convert_samples(const DeepImage *img, int type);
+void free_deep(DeepImage *img);
+
+// Input and output file names of a batch run
+typedef struct
+{
+    char **inputs;
+    char **outputs;
+    int count;
+    int capacity;
+} BatchList;
+
+int collect_batch(const char *source, const char *output_dir, BatchList *list);
+void free_batch(BatchList *list);
+
+// PPM files mapped into memory; data points into the mapping
+PPMImage *map_ppm(const char *filename);
+PPMImage *create_mapped_ppm(const char *filename, int width, int height);
+int unmap_ppm(PPMImage *img);
+
+// Filters the pixels of one image in place
+typedef void (*BatchFilter)(unsigned char *pixels, int width, int height, void *context);
+
+int uring_batch_run(const BatchList *list, int depth, BatchFilter filter, void *context);
+
+// Image split into a full-resolution luma plane and a chroma plane subsampled 2x2
+typedef struct
+{
+    int width, height;               // luma size
+    int chroma_width, chroma_height; // (width + 1) / 2, (height + 1) / 2
+    unsigned char *luma;
+    unsigned char *chroma; // [Cb, Cr, Cb, Cr, ...]
+} YCbCrImage;
+
+YCbCrImage *rgb_to_ycbcr420(const PPMImage *img);
+void ycbcr420_to_rgb(const YCbCrImage *ycc, PPMImage *img);
+void free_ycbcr(YCbCrImage *ycc);
+
+#endif
@@ -1,77 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include <time.h>
+#include <math.h>
 #include <omp.h> // Include OpenMP header
+#include "image_io.h"
 
-typedef struct {
-    int width;
-    int height;
-    unsigned char *data; // RGB data stored as [R, G, B, R, G, B, ...]
-} PPMImage;
-
-// Read PPM (P6 format)
-PPMImage* read_ppm(const char *filename) {
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) { perror("Error opening file"); return NULL; }
-
-    PPMImage *img = (PPMImage*)malloc(sizeof(PPMImage));
-    char version[3];
-    if (fscanf(fp, "%2s", version) != 1) {
-        fprintf(stderr, "Error reading PPM version\n");
-        fclose(fp);
-        free(img);
-        return NULL;
-    }
-    if (version[1] != '6') {
-        fprintf(stderr, "Only P6 supported\n");
-        fclose(fp);
-        free(img);
-        return NULL;
-    }
-
-    if (fscanf(fp, "%d %d %*d", &img->width, &img->height) != 2) {
-        fprintf(stderr, "Error reading image dimensions\n");
-        fclose(fp);
-        free(img);
-        return NULL;
-    }
-    fgetc(fp); // Skip newline
-
-    img->data = (unsigned char*)malloc(img->width * img->height * 3);
-    if (fread(img->data, 1, img->width * img->height * 3, fp) != img->width * img->height * 3) {
-        fprintf(stderr, "Error reading image data\n");
-        fclose(fp);
-        free(img->data);
-        free(img);
-        return NULL;
-    }
-    fclose(fp);
-    return img;
-}
-
-// Write PPM (P6 format)
-void write_ppm(const char *filename, PPMImage *img) {
-    FILE *fp = fopen(filename, "wb");
-    fprintf(fp, "P6\n%d %d\n255\n", img->width, img->height);
-    fwrite(img->data, 1, img->width * img->height * 3, fp);
-    fclose(fp);
-}
-
-// Median filter for RGB image (3x3 kernel)
-void median_filter_rgb(PPMImage *input, PPMImage *output) {
+// Median filter of an interleaved plane with channels samples per pixel (3x3 kernel)
+void median_filter_plane(const unsigned char *src, unsigned char *dst, int width, int height, int channels) {
     #pragma omp parallel for collapse(3) // Parallelize the loops
-    for (int y = 1; y < input->height - 1; y++) {
-        for (int x = 1; x < input->width - 1; x++) {
-            for (int c = 0; c < 3; c++) { // Process each channel (R, G, B)
+    for (int y = 1; y < height - 1; y++) {
+        for (int x = 1; x < width - 1; x++) {
+            for (int c = 0; c < channels; c++) { // Process each channel
                 unsigned char window[9];
                 int idx = 0;
 
                 // Collect 3x3 neighborhood for the current channel
                 for (int dy = -1; dy <= 1; dy++) {
                     for (int dx = -1; dx <= 1; dx++) {
-                        int neighbor_idx = ((y + dy) * input->width + (x + dx)) * 3 + c;
-                        window[idx++] = input->data[neighbor_idx];
+                        int neighbor_idx = ((y + dy) * width + (x + dx)) * channels + c;
+                        window[idx++] = src[neighbor_idx];
                     }
                 }
 
@@ -87,16 +35,385 @@ void median_filter_rgb(PPMImage *input, PPMImage *output) {
                 }
 
                 // Set the median value for the current channel
-                int output_idx = (y * input->width + x) * 3 + c;
-                output->data[output_idx] = window[4]; // Median
+                int output_idx = (y * width + x) * channels + c;
+                dst[output_idx] = window[4]; // Median
+            }
+        }
+    }
+}
+
+// Median filter for RGB image (3x3 kernel)
+void median_filter_rgb(PPMImage *input, PPMImage *output) {
+    median_filter_plane(input->data, output->data, input->width, input->height, 3);
+}
+
+// Median filter every image in list, in one process. The OpenMP thread pool and the output
+// buffer of each slot live across images; concurrent images are in flight at once, each on its
+// share of the threads, so small frames still keep every core busy and one image's I/O overlaps
+// the others' filtering. Returns the number of images that failed.
+int median_filter_batch(const BatchList *list, int concurrent) {
+    int threads = omp_get_max_threads();
+    if (concurrent > threads)
+        concurrent = threads;
+    if (concurrent > list->count)
+        concurrent = list->count;
+    int inner = threads / concurrent;
+    omp_set_max_active_levels(2);
+
+    int next_image = 0, failed = 0;
+    #pragma omp parallel num_threads(concurrent)
+    {
+        // Parallel regions opened by this slot (filter, PNG and tile I/O) use its share
+        omp_set_num_threads(inner);
+        unsigned char *buffer = NULL;
+        size_t capacity = 0;
+        for (;;) {
+            int k;
+            #pragma omp atomic capture
+            k = next_image++;
+            if (k >= list->count)
+                break;
+
+            PPMImage *input = read_image(list->inputs[k]);
+            if (!input) {
+                fprintf(stderr, "Skipping %s\n", list->inputs[k]);
+                #pragma omp atomic
+                failed++;
+                continue;
+            }
+            size_t bytes = (size_t)input->width * input->height * 3;
+            if (bytes > capacity) {
+                buffer = (unsigned char *)realloc(buffer, bytes);
+                capacity = bytes;
+            }
+            memcpy(buffer, input->data, bytes); // border pixels keep their input values
+
+            PPMImage output = {input->width, input->height, buffer};
+            median_filter_rgb(input, &output);
+            if (write_image(list->outputs[k], &output) != 0) {
+                #pragma omp atomic
+                failed++;
+            }
+            free(input->data);
+            free(input);
+        }
+        free(buffer);
+    }
+    return failed;
+}
+
+// Scratch copy of the input kept across images by median_batch_filter
+typedef struct {
+    unsigned char *scratch;
+    size_t capacity;
+} MedianBatchFilter;
+
+static void median_batch_filter(unsigned char *pixels, int width, int height, void *context) {
+    MedianBatchFilter *filter = (MedianBatchFilter *)context;
+    size_t bytes = (size_t)width * height * 3;
+    if (bytes > filter->capacity) {
+        filter->scratch = (unsigned char *)realloc(filter->scratch, bytes);
+        filter->capacity = bytes;
+    }
+    // The median goes straight back into the pool buffer, whose border keeps the input values
+    memcpy(filter->scratch, pixels, bytes);
+    median_filter_plane(filter->scratch, pixels, width, height, 3);
+}
+
+// median_filter_batch with io_uring reads and writes of depth images ahead and behind
+int median_filter_batch_uring(const BatchList *list, int depth) {
+    MedianBatchFilter filter = {NULL, 0};
+    int failed = uring_batch_run(list, depth, median_batch_filter, &filter);
+    free(filter.scratch);
+    return failed;
+}
+
+// Compare-exchange pairs of the 19-comparator median-of-9 selection network (Paeth, Graphics
+// Gems); afterwards element 4 holds the median. Fewer comparisons than sorting the window and
+// no data-dependent branches.
+static const int median9_network[19][2] = {
+    {1, 2}, {4, 5}, {7, 8}, {0, 1}, {3, 4}, {6, 7}, {1, 2}, {4, 5}, {7, 8}, {0, 3},
+    {5, 8}, {4, 7}, {3, 6}, {1, 4}, {2, 5}, {4, 7}, {4, 2}, {6, 4}, {4, 2}};
+
+// 3x3 median of every interior sample for any sample type. Always inlined with a constant type,
+// so median_filter_u8/_u16/_f32 are separate kernels; the window is held as floats, which is
+// exact for 8- and 16-bit samples, and min/max make every compare-exchange branch-free.
+static inline __attribute__((always_inline)) void median_filter_samples(const void *src, void *dst, int width,
+                                                                       int height, int type) {
+    #pragma omp parallel for collapse(2)
+    for (int y = 1; y < height - 1; y++) {
+        for (int x = 1; x < width - 1; x++) {
+            for (int c = 0; c < 3; c++) {
+                float window[9];
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                        window[(dy + 1) * 3 + dx + 1] = sample_load(src, ((size_t)(y + dy) * width + x + dx) * 3 + c, type);
+
+                for (int i = 0; i < 19; i++) {
+                    float a = window[median9_network[i][0]], b = window[median9_network[i][1]];
+                    window[median9_network[i][0]] = fminf(a, b);
+                    window[median9_network[i][1]] = fmaxf(a, b);
+                }
+                sample_store(dst, ((size_t)y * width + x) * 3 + c, window[4], type);
+            }
+        }
+    }
+}
+
+static void median_filter_u8(const void *src, void *dst, int width, int height) {
+    median_filter_samples(src, dst, width, height, SAMPLE_U8);
+}
+
+static void median_filter_u16(const void *src, void *dst, int width, int height) {
+    median_filter_samples(src, dst, width, height, SAMPLE_U16);
+}
+
+static void median_filter_f32(const void *src, void *dst, int width, int height) {
+    median_filter_samples(src, dst, width, height, SAMPLE_F32);
+}
+
+// Median filter of a DeepImage; output must have the same size and type as input. Border
+// samples are left as they are in output.
+void median_filter_deep(DeepImage *input, DeepImage *output) {
+    if (input->type == SAMPLE_U8)
+        median_filter_u8(input->data, output->data, input->width, input->height);
+    else if (input->type == SAMPLE_U16)
+        median_filter_u16(input->data, output->data, input->width, input->height);
+    else
+        median_filter_f32(input->data, output->data, input->width, input->height);
+}
+
+// Median filter in YCbCr: the luma plane at full resolution, the chroma at 2x2 subsampling,
+// so about half the samples of median_filter_rgb are filtered
+void median_filter_ycbcr(PPMImage *input, PPMImage *output) {
+    YCbCrImage *ycc = rgb_to_ycbcr420(input);
+
+    // The filter leaves the plane borders alone, so they start as copies
+    int luma_size = ycc->width * ycc->height;
+    int chroma_size = ycc->chroma_width * ycc->chroma_height * 2;
+    unsigned char *luma = (unsigned char*)malloc(luma_size);
+    unsigned char *chroma = (unsigned char*)malloc(chroma_size);
+    memcpy(luma, ycc->luma, luma_size);
+    memcpy(chroma, ycc->chroma, chroma_size);
+
+    median_filter_plane(ycc->luma, luma, ycc->width, ycc->height, 1);
+    median_filter_plane(ycc->chroma, chroma, ycc->chroma_width, ycc->chroma_height, 2);
+
+    free(ycc->luma);
+    free(ycc->chroma);
+    ycc->luma = luma;
+    ycc->chroma = chroma;
+    ycbcr420_to_rgb(ycc, output);
+    free_ycbcr(ycc);
+}
+
+// Rows [start, end) of the input and output that one band of the streaming median holds
+typedef struct {
+    int first_row, last_row;     // output rows [first_row, last_row) produced by the band
+    int in_start, in_end;        // input rows held, the output rows plus a one-row halo
+    unsigned char *in, *out;     // (band_rows + 2) rows each
+} MedianBand;
+
+static void median_band_rows(MedianBand *band, int index, int band_rows, int height) {
+    band->first_row = index * band_rows;
+    band->last_row = (band->first_row + band_rows < height) ? band->first_row + band_rows : height;
+    band->in_start = (band->first_row > 0) ? band->first_row - 1 : 0;
+    band->in_end = (band->last_row < height) ? band->last_row + 1 : height;
+}
+
+// Fill the input rows of band from fp, which is positioned at row prev->in_end (or at the first
+// pixel for the first band). The halo rows shared with the previous band are copied from it.
+static int median_band_read(FILE *fp, MedianBand *band, const MedianBand *prev, int width) {
+    size_t row_bytes = (size_t)width * 3;
+    int row = band->in_start;
+    if (prev) {
+        for (; row < prev->in_end; row++)
+            memcpy(band->in + (row - band->in_start) * row_bytes, prev->in + (row - prev->in_start) * row_bytes, row_bytes);
+    }
+    size_t bytes = (band->in_end - row) * row_bytes;
+    return fread(band->in + (row - band->in_start) * row_bytes, 1, bytes, fp) == bytes ? 0 : -1;
+}
+
+// Streaming median filter for images larger than memory. The body of the PPM is read in bands
+// of band_rows rows plus a one-row halo on each side, and every band is filtered with
+// median_filter_plane and written out. Two band buffers alternate so that, while band k is
+// filtered by the thread team, band k + 1 is read and band k - 1 written by two more threads.
+// Peak memory is 4 * (band_rows + 2) rows. Pixels on the image border are copied from the input.
+// Returns 0 on success.
+int median_filter_stream(const char *input_file, const char *output_file, int band_rows) {
+    FILE *in = fopen(input_file, "rb");
+    if (!in) { perror("Error opening file"); return -1; }
+
+    char version[3];
+    int width, height;
+    if (fscanf(in, "%2s", version) != 1 || version[1] != '6' ||
+        fscanf(in, "%d %d %*d", &width, &height) != 2) {
+        fprintf(stderr, "Only P6 supported\n");
+        fclose(in);
+        return -1;
+    }
+    fgetc(in); // Skip newline
+
+    FILE *out = fopen(output_file, "wb");
+    if (!out) { perror("Error opening output file"); fclose(in); return -1; }
+    fprintf(out, "P6\n%d %d\n255\n", width, height);
+
+    size_t row_bytes = (size_t)width * 3;
+    MedianBand bands[2];
+    for (int b = 0; b < 2; b++) {
+        bands[b].in = (unsigned char*)malloc((band_rows + 2) * row_bytes);
+        bands[b].out = (unsigned char*)malloc((band_rows + 2) * row_bytes);
+    }
+
+    int count = (height + band_rows - 1) / band_rows;
+    int read_error = 0, write_error = 0;
+    median_band_rows(&bands[0], 0, band_rows, height);
+    read_error = median_band_read(in, &bands[0], NULL, width);
+
+    // The filter runs in a nested team next to the I/O threads
+    omp_set_max_active_levels(2);
+    for (int k = 0; k <= count && !read_error && !write_error; k++) {
+        MedianBand *current = &bands[k % 2];
+        MedianBand *other = &bands[(k + 1) % 2];
+        MedianBand finished = *other; // band k - 1; the reader reuses the input rows of its buffer
+
+        #pragma omp parallel sections num_threads(3)
+        {
+            #pragma omp section
+            {
+                // Read band k + 1; it shares its halo rows with band k
+                if (k + 1 < count) {
+                    median_band_rows(other, k + 1, band_rows, height);
+                    if (median_band_read(in, other, current, width) != 0)
+                        read_error = 1;
+                }
+            }
+            #pragma omp section
+            {
+                // Write band k - 1
+                if (k >= 1) {
+                    size_t bytes = (finished.last_row - finished.first_row) * row_bytes;
+                    const unsigned char *rows = finished.out + (finished.first_row - finished.in_start) * row_bytes;
+                    if (fwrite(rows, 1, bytes, out) != bytes)
+                        write_error = 1;
+                }
+            }
+            #pragma omp section
+            {
+                // Filter band k
+                if (k < count) {
+                    int rows = current->in_end - current->in_start;
+                    memcpy(current->out, current->in, rows * row_bytes);
+                    median_filter_plane(current->in, current->out, width, rows, 3);
+                }
             }
         }
     }
+    if (read_error)
+        fprintf(stderr, "Error reading image data\n");
+    if (fclose(out) != 0 || write_error) {
+        fprintf(stderr, "Error writing image data to %s\n", output_file);
+        write_error = 1;
+    }
+
+    fclose(in);
+    for (int b = 0; b < 2; b++) {
+        free(bands[b].in);
+        free(bands[b].out);
+    }
+    return (read_error || write_error) ? -1 : 0;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <input.ppm> <output.ppm>\n", argv[0]);
+    if (argc < 3) {
+        printf("Usage: %s <input.ppm> <output.ppm> [--colorspace=rgb|ycbcr] [--mmap] [--stream] [--band=N]"
+               " [--samples=u8|u16|float] [--batch] [--concurrent=N] [--io=stdio|uring] [--io-depth=N]\n"
+               "       %s <dir|glob|manifest> <output_dir> --batch [--concurrent=N] [--io=stdio|uring]"
+               " [--io-depth=N]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    int ycbcr = 0;
+    int use_mmap = 0;
+    int stream = 0;
+    int band_rows = 256;
+    int sample_type = -1; // < 0: 8-bit path unless the input is deeper
+    int batch = 0;
+    int concurrent = 1;
+    int io_uring = 0;
+    int io_depth = 4;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        } else if (strncmp(argv[i], "--band=", 7) == 0) {
+            band_rows = atoi(argv[i] + 7);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            batch = 1;
+        } else if (strncmp(argv[i], "--concurrent=", 13) == 0) {
+            concurrent = atoi(argv[i] + 13);
+        } else if (strcmp(argv[i], "--io=stdio") == 0) {
+            io_uring = 0;
+        } else if (strcmp(argv[i], "--io=uring") == 0) {
+            io_uring = 1;
+        } else if (strncmp(argv[i], "--io-depth=", 11) == 0) {
+            io_depth = atoi(argv[i] + 11);
+        } else if (strcmp(argv[i], "--samples=u8") == 0) {
+            sample_type = SAMPLE_U8;
+        } else if (strcmp(argv[i], "--samples=u16") == 0) {
+            sample_type = SAMPLE_U16;
+        } else if (strcmp(argv[i], "--samples=float") == 0) {
+            sample_type = SAMPLE_F32;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            use_mmap = 1;
+        } else if (strcmp(argv[i], "--colorspace=rgb") == 0) {
+            ycbcr = 0;
+        } else if (strcmp(argv[i], "--colorspace=ycbcr") == 0) {
+            ycbcr = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (stream && (use_mmap || ycbcr)) {
+        fprintf(stderr, "--stream cannot be combined with --mmap or --colorspace=ycbcr.\n");
+        return 1;
+    }
+    if ((use_mmap || stream) && (is_png_file(argv[1]) || is_png_file(argv[2]))) {
+        fprintf(stderr, "--mmap and --stream need PPM input and output files.\n");
+        return 1;
+    }
+    // PPM input with more than 8 bits per sample, or an explicit --samples, goes through the
+    // sample-generic kernel
+    int deep = sample_type >= 0 || (!batch && !is_png_file(argv[1]) && !has_extension(argv[1], ".tim") &&
+                                     ppm_maxval(argv[1]) > 255);
+    if (batch && (ycbcr || use_mmap || stream || deep)) {
+        fprintf(stderr, "--batch runs the plain median filter and cannot be combined with other modes.\n");
+        return 1;
+    }
+    if (concurrent <= 0) {
+        fprintf(stderr, "The number of concurrent images must be a positive integer.\n");
+        return 1;
+    }
+    if (io_uring && (!batch || concurrent > 1)) {
+        fprintf(stderr, "--io=uring applies to --batch runs with one image in flight at a time.\n");
+        return 1;
+    }
+    if (io_depth <= 0) {
+        fprintf(stderr, "The I/O depth must be a positive integer.\n");
+        return 1;
+    }
+    if (deep && (ycbcr || use_mmap || stream)) {
+        fprintf(stderr, "High-bit-depth input and --samples cannot be combined with other modes.\n");
+        return 1;
+    }
+    if (deep && (is_png_file(argv[1]) || is_png_file(argv[2]) || has_extension(argv[1], ".tim") ||
+                 has_extension(argv[2], ".tim"))) {
+        fprintf(stderr, "High-bit-depth input and --samples need PPM input and output files.\n");
+        return 1;
+    }
+    if (band_rows <= 0) {
+        fprintf(stderr, "The band height must be a positive integer.\n");
         return 1;
     }
 
@@ -110,29 +427,107 @@ int main(int argc, char *argv[]) {
     // Start timing for the entire process
     double total_start_time = omp_get_wtime();
 
-    // Read input image
-    PPMImage *input = read_ppm(input_file);
+    if (batch) {
+        BatchList list;
+        int count = collect_batch(input_file, output_file, &list);
+        if (count <= 0) {
+            if (count == 0) fprintf(stderr, "No images found in %s.\n", input_file);
+            return 1;
+        }
+        int failed;
+        if (io_uring) {
+            for (int k = 0; k < list.count; k++) {
+                if (!has_extension(list.inputs[k], ".ppm") || !has_extension(list.outputs[k], ".ppm")) {
+                    fprintf(stderr, "--io=uring needs PPM input and output files: %s\n", list.inputs[k]);
+                    free_batch(&list);
+                    return 1;
+                }
+            }
+            failed = median_filter_batch_uring(&list, io_depth);
+            if (failed < 0) {
+                fprintf(stderr, "io_uring is not available, falling back to --io=stdio.\n");
+                io_uring = 0;
+            }
+        }
+        if (!io_uring)
+            failed = median_filter_batch(&list, concurrent);
+        double elapsed = omp_get_wtime() - total_start_time;
+        printf("Batch of %d images (%d failed) completed at %.1f images per second.\n", count, failed,
+               count / elapsed);
+        printf("Total process completed in %.4f seconds.\n", elapsed);
+        free_batch(&list);
+        return failed ? 1 : 0;
+    }
+
+    if (stream) {
+        // Reading, filtering and writing overlap, so only the total time is meaningful
+        if (median_filter_stream(input_file, output_file, band_rows) != 0) return 1;
+        printf("Total process completed in %.4f seconds.\n", omp_get_wtime() - total_start_time);
+        return 0;
+    }
+
+    if (deep) {
+        DeepImage *file = read_ppm_deep(input_file);
+        if (!file) return 1;
+        if (sample_type < 0) sample_type = file->type;
+        if (sample_type == SAMPLE_U8 && file->maxval > 255) {
+            fprintf(stderr, "--samples=u8 cannot hold maxval %d.\n", file->maxval);
+            return 1;
+        }
+        DeepImage *input = convert_samples(file, sample_type);
+        DeepImage *output = convert_samples(file, sample_type); // border samples stay as read
+
+        double start_time = omp_get_wtime();
+        median_filter_deep(input, output);
+        printf("Median filtering completed in %.4f seconds.\n", omp_get_wtime() - start_time);
+
+        // Written back with the depth of the input file
+        DeepImage *result = convert_samples(output, file->type);
+        if (write_ppm_deep(output_file, result) != 0) return 1;
+        printf("Total process completed in %.4f seconds.\n", omp_get_wtime() - total_start_time);
+
+        free_deep(result);
+        free_deep(output);
+        free_deep(input);
+        free_deep(file);
+        return 0;
+    }
+
+    // Read input image; with --mmap the pixels are read straight from the page cache of the
+    // file and the filter writes into a shared mapping of the output file
+    PPMImage *input = use_mmap ? map_ppm(input_file) : read_image(input_file);
     if (!input) return 1;
 
     // Allocate output image
-    PPMImage *output = (PPMImage*)malloc(sizeof(PPMImage));
-    output->width = input->width;
-    output->height = input->height;
-    output->data = (unsigned char*)malloc(input->width * input->height * 3);
+    PPMImage *output;
+    if (use_mmap) {
+        output = create_mapped_ppm(output_file, input->width, input->height);
+        if (!output) return 1;
+    } else {
+        output = (PPMImage*)malloc(sizeof(PPMImage));
+        output->width = input->width;
+        output->height = input->height;
+        output->data = (unsigned char*)malloc(input->width * input->height * 3);
+    }
+    // Border pixels keep their input values, as in the batch, stream and deep modes
+    memcpy(output->data, input->data, (size_t)input->width * input->height * 3);
 
     // Start timing for median filtering
     double start_time = omp_get_wtime();
 
     // Perform median filtering
-    median_filter_rgb(input, output);
+    if (ycbcr)
+        median_filter_ycbcr(input, output);
+    else
+        median_filter_rgb(input, output);
 
     // End timing for median filtering
     double end_time = omp_get_wtime();
     double elapsed_time = end_time - start_time;
     printf("Median filtering completed in %.4f seconds.\n", elapsed_time);
 
-    // Write output image
-    write_ppm(output_file, output);
+    // Write output image (a mapped output is complete once unmapped)
+    if (!use_mmap && write_image(output_file, output) != 0) return 1;
 
     // End timing for the entire process
     double total_end_time = omp_get_wtime();
@@ -140,10 +535,15 @@ int main(int argc, char *argv[]) {
     printf("Total process completed in %.4f seconds.\n", total_elapsed_time);
 
     // Free memory
-    free(input->data);
-    free(input);
-    free(output->data);
-    free(output);
+    if (use_mmap) {
+        unmap_ppm(input);
+        if (unmap_ppm(output) != 0) return 1;
+    } else {
+        free(input->data);
+        free(input);
+        free(output->data);
+        free(output);
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+// Converts between PPM (P6) and the tiled .tim container used by the OpenMP programs, or
+// extracts a region of a .tim file without reading the rest of it.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <omp.h>
+#include "image_io.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s <input.ppm|input.tim> <output.ppm|output.tim> [--tile=N] [--region=x,y,w,h]\n", argv[0]);
+        return 1;
+    }
+
+    int tile_size = TILED_DEFAULT_TILE;
+    int region[4] = {0, 0, INT_MAX, INT_MAX};
+    int has_region = 0;
+    for (int i = 3; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--tile=", 7) == 0)
+            tile_size = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--region=", 9) == 0)
+        {
+            if (sscanf(argv[i] + 9, "%d,%d,%d,%d", &region[0], &region[1], &region[2], &region[3]) != 4)
+            {
+                fprintf(stderr, "--region expects x,y,width,height\n");
+                return 1;
+            }
+            has_region = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (tile_size <= 0 || tile_size > 8192)
+    {
+        fprintf(stderr, "The tile size must be between 1 and 8192 pixels.\n");
+        return 1;
+    }
+    int tiled_input = has_extension(argv[1], ".tim");
+    if (has_region && !tiled_input)
+    {
+        fprintf(stderr, "--region needs a .tim input.\n");
+        return 1;
+    }
+
+    double start_time = omp_get_wtime();
+    // A region is read by fetching only the tiles it overlaps
+    PPMImage *img = tiled_input ? read_tiled_region(argv[1], region[0], region[1], region[2], region[3])
+                                : read_ppm(argv[1]);
+    if (!img)
+        return 1;
+    double read_time = omp_get_wtime() - start_time;
+
+    start_time = omp_get_wtime();
+    int status = has_extension(argv[2], ".tim") ? write_tiled(argv[2], img, tile_size) : write_ppm(argv[2], img);
+    if (status != 0)
+        return 1;
+    printf("Read %dx%d pixels in %.4f seconds, written in %.4f seconds.\n", img->width, img->height, read_time,
+           omp_get_wtime() - start_time);
+
+    free(img->data);
+    free(img);
+    return 0;
+}
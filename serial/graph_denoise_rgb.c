@@ -1,5 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <png.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
@@ -58,14 +60,145 @@ void write_ppm(const char *filename, PPMImage *img) {
     fclose(fp);
 }
 
-// Enhanced edge-aware graph diffusion
-void graph_diffusion_rgb(PPMImage *input, PPMImage *output, float alpha, int iterations) {
+// Read an 8-bit RGB image from a PNG file with the libpng simplified API; grey, palette,
+// 16-bit and alpha images are converted (alpha is composited onto black)
+PPMImage *read_png(const char *filename) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename)) {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        return NULL;
+    }
+    image.format = PNG_FORMAT_RGB;
+
+    PPMImage *img = (PPMImage *)malloc(sizeof(PPMImage));
+    img->width = image.width;
+    img->height = image.height;
+    img->data = (unsigned char *)calloc(PNG_IMAGE_SIZE(image), 1);
+    if (!png_image_finish_read(&image, NULL, img->data, 0, NULL)) {
+        fprintf(stderr, "Error reading PNG %s: %s\n", filename, image.message);
+        png_image_free(&image);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+// Write an 8-bit RGB PNG; returns 0 on success
+int write_png(const char *filename, PPMImage *img) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = img->width;
+    image.height = img->height;
+    image.format = PNG_FORMAT_RGB;
+    if (!png_image_write_to_file(&image, filename, 0, img->data, 0, NULL)) {
+        fprintf(stderr, "Error writing PNG %s: %s\n", filename, image.message);
+        return -1;
+    }
+    return 0;
+}
+
+// Files ending in ".png" (any case) are PNG, everything else PPM
+int is_png_file(const char *filename) {
+    size_t length = strlen(filename);
+    if (length < 4)
+        return 0;
+    const char *ext = filename + length - 4;
+    return ext[0] == '.' && tolower((unsigned char)ext[1]) == 'p' && tolower((unsigned char)ext[2]) == 'n' &&
+           tolower((unsigned char)ext[3]) == 'g';
+}
+
+PPMImage *read_image(const char *filename) {
+    return is_png_file(filename) ? read_png(filename) : read_ppm(filename);
+}
+
+// Returns 0 on success
+int write_image(const char *filename, PPMImage *img) {
+    if (is_png_file(filename))
+        return write_png(filename, img);
+    write_ppm(filename, img);
+    return 0;
+}
+
+// Fixed-point variant of the graph kernel. Weights are Q15 integers from a table indexed by
+// the absolute difference, alpha is Q8, and the weighted average, threshold test and update
+// are done in integer arithmetic with flooring divides. Results do not depend on FMA
+// contraction or the expf implementation, so every backend produces the same bits.
+#define FIXED_WEIGHT_BITS 15
+#define FIXED_ALPHA_BITS 8
+
+// Q15 Gaussian weight for every absolute difference 0..255. Computed in double and rounded,
+// so all backends get the same integers.
+void graph_fixed_weight_table(int table[256], float sigma) {
+    for (int d = 0; d < 256; d++)
+        table[d] = (int)floor(exp(-(double)(d * d) / (2.0 * sigma * sigma)) * (1 << FIXED_WEIGHT_BITS) + 0.5);
+}
+
+int graph_fixed_alpha(float alpha) {
+    return (int)floor((double)alpha * (1 << FIXED_ALPHA_BITS) + 0.5);
+}
+
+// num / den rounded down, like the float kernels' conversion to unsigned char (den > 0)
+static inline long long fixed_div_floor(long long num, long long den) {
+    return (num >= 0) ? num / den : -((-num + den - 1) / den);
+}
+
+// Integer counterpart of the float update
+static inline unsigned char graph_fixed_sample(int center, const int neighbors[4], const int *weight_table,
+                                               int alpha_q, int threshold) {
+    int weight_sum = 0, weighted_value = 0;
+    for (int i = 0; i < 4; i++) {
+        int weight = weight_table[abs(neighbors[i] - center)];
+        weight_sum += weight;
+        weighted_value += weight * neighbors[i];
+    }
+    if (weight_sum == 0) {
+        // Every neighbour is more than ~94 levels away. The float weights are then dominated by the
+        // closest neighbours, so take their mean (always above the threshold).
+        int closest = 256;
+        for (int i = 0; i < 4; i++) {
+            int diff = abs(neighbors[i] - center);
+            if (diff < closest) {
+                closest = diff;
+                weight_sum = 0;
+                weighted_value = 0;
+            }
+            if (diff == closest) {
+                weight_sum++;
+                weighted_value += neighbors[i];
+            }
+        }
+    }
+
+    // (smooth_value - center) scaled by weight_sum
+    long long deviation = weighted_value - (long long)center * weight_sum;
+    long long result;
+    if (llabs(deviation) > (long long)threshold * weight_sum)
+        result = fixed_div_floor(weighted_value, weight_sum);
+    else
+        result = fixed_div_floor(((long long)center * weight_sum << FIXED_ALPHA_BITS) + alpha_q * deviation,
+                                 (long long)weight_sum << FIXED_ALPHA_BITS);
+    return (unsigned char)(result < 0 ? 0 : (result > 255 ? 255 : result));
+}
+
+// Enhanced edge-aware graph diffusion. With fixed_point set, every sample goes through the
+// integer kernel graph_fixed_sample instead of the float update.
+void graph_diffusion_rgb(PPMImage *input, PPMImage *output, float alpha, int iterations, int fixed_point) {
+    // Both buffers start from the input so the (never updated) border rows/columns are valid
     unsigned char *temp = (unsigned char*)malloc(input->width * input->height * 3);
     memcpy(temp, input->data, input->width * input->height * 3);
+    memcpy(output->data, input->data, input->width * input->height * 3);
 
     int width = input->width, height = input->height;
     float sigma = 20.0f, threshold = 20.0f;
 
+    int weight_table[256];
+    int alpha_q = graph_fixed_alpha(alpha);
+    graph_fixed_weight_table(weight_table, sigma);
+
     for (int iter = 0; iter < iterations; iter++) {
         for (int y = 1; y < height - 1; y++) {
             for (int x = 1; x < width - 1; x++) {
@@ -80,6 +213,11 @@ void graph_diffusion_rgb(PPMImage *input, PPMImage *output, float alpha, int ite
                         temp[(y * width + (x + 1)) * 3 + c]
                     };
 
+                    if (fixed_point) {
+                        output->data[idx] = graph_fixed_sample(center, neighbors, weight_table, alpha_q, (int)threshold);
+                        continue;
+                    }
+
                     float weight_sum = 0.0f, weighted_value = 0.0f;
                     for (int i = 0; i < 4; i++) {
                         float diff = neighbors[i] - center;
@@ -101,21 +239,30 @@ void graph_diffusion_rgb(PPMImage *input, PPMImage *output, float alpha, int ite
         output->data = swap;
     }
 
-    if (iterations % 2 == 1) {
-        memcpy(output->data, temp, width * height * 3);
-    }
-
-    free(temp);
+    // After the last swap temp holds the newest state
+    unsigned char *stale = output->data;
+    output->data = temp;
+    free(stale);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations>\n", argv[0]);
+    if (argc < 5) {
+        printf("Usage: %s <input.ppm> <output.ppm> <alpha> <iterations> [--fixed-point]\n", argv[0]);
         return 1;
     }
 
     float alpha = atof(argv[3]);
     int iterations = atoi(argv[4]);
+
+    int fixed_point = 0;
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "--fixed-point") == 0) {
+            fixed_point = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
     if (iterations <= 0) {
         fprintf(stderr, "Iterations must be a positive integer.\n");
         return 1;
@@ -123,7 +270,7 @@ int main(int argc, char *argv[]) {
 
     clock_t total_start_time = clock();
 
-    PPMImage *input = read_ppm(argv[1]);
+    PPMImage *input = read_image(argv[1]);
     if (!input) return 1;
 
     PPMImage *output = (PPMImage*)malloc(sizeof(PPMImage));
@@ -132,11 +279,11 @@ int main(int argc, char *argv[]) {
     output->data = (unsigned char*)malloc(input->width * input->height * 3);
 
     clock_t start_time = clock();
-    graph_diffusion_rgb(input, output, alpha, iterations);
+    graph_diffusion_rgb(input, output, alpha, iterations, fixed_point);
     printf("Graph filtering completed %.4f seconds.\n", 
            (double)(clock() - start_time) / CLOCKS_PER_SEC);
 
-    write_ppm(argv[2], output);
+    write_image(argv[2], output);
 
     printf("Total (graph) process completed in %.4f seconds.\n", 
            (double)(clock() - total_start_time) / CLOCKS_PER_SEC);